@@ -1,2 +1,5 @@
 echo "This should run your application."
-./flow $1 $2 $3 $4
+# Keep every OpenMP thread on one core, so the pages it first touched stay on its NUMA node.
+export OMP_PROC_BIND=${OMP_PROC_BIND:-close}
+export OMP_PLACES=${OMP_PLACES:-cores}
+./flow "$@"
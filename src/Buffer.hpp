@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+
+// Process-wide pool of 64-byte aligned memory blocks. Requests are rounded up
+// to size classes (four per power of two) and released blocks are kept per
+// class, so the buffers of the multigrid levels and of consecutive frames are
+// recycled instead of going back to the system and being page-faulted in
+// again. With FLOW_HUGEPAGES=1 blocks of 2 MiB and more are 2 MiB aligned and
+// marked for transparent huge pages.
+//
+// An arena is one contiguous block that a thread can carve consecutive
+// allocations from (see BufferArena). Its block is taken from the size
+// classes and goes back to them once the arena is closed and every block
+// carved from it has been released, so the arena of the next frame pair
+// reuses it. Open arenas are kept sorted by address, so a release finds its
+// arena by binary search.
+//
+// Cached blocks are only returned to the system by trim(). The solver never
+// calls it: all frames of a run have the same size, so every class is reused.
+class BufferPool
+{
+    public:
+        struct Arena {
+            char *base;
+            size_t capacity;
+            size_t used;
+            size_t live;
+            bool open;
+        };
+
+        static constexpr size_t alignment = 64;
+        static constexpr size_t hugePageSize = size_t(2) << 20;
+
+        // Never destroyed, so containers with static storage duration can
+        // still return their blocks at exit.
+        static BufferPool& instance() {
+            static BufferPool *pool = new BufferPool();
+            return *pool;
+        }
+
+        void* allocate(size_t bytes) {
+            if(active != nullptr) {
+                std::lock_guard<std::mutex> lock(mutex);
+                size_t size = ((bytes + alignment - 1) / alignment) * alignment;
+                if(active->used + size <= active->capacity) {
+                    void *block = active->base + active->used;
+                    active->used += size;
+                    active->live++;
+                    return block;
+                }
+            }
+
+            size_t size = sizeClass(bytes);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::vector<void*> &blocks = freeBlocks[size];
+                if(!blocks.empty()) {
+                    void *block = blocks.back();
+                    blocks.pop_back();
+                    cached -= size;
+                    return block;
+                }
+            }
+
+            return systemAllocate(size);
+        }
+
+        void release(void *block, size_t bytes) noexcept {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!arenas.empty()) {
+                char *p = static_cast<char*>(block);
+                auto next = std::upper_bound(arenas.begin(), arenas.end(), p,
+                                             [](const char *q, const Arena *a) { return q < a->base; });
+                if(next != arenas.begin()) {
+                    Arena *arena = *(next - 1);
+                    if(p < arena->base + arena->capacity) {
+                        arena->live--;
+                        if(!arena->open && (arena->live == 0))
+                            freeArena(size_t(next - 1 - arenas.begin()));
+                        return;
+                    }
+                }
+            }
+            size_t size = sizeClass(bytes);
+            freeBlocks[size].push_back(block);
+            cached += size;
+        }
+
+        Arena* openArena(size_t bytes) {
+            size_t size = sizeClass(bytes);
+            char *base = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::vector<void*> &blocks = freeBlocks[size];
+                if(!blocks.empty()) {
+                    base = static_cast<char*>(blocks.back());
+                    blocks.pop_back();
+                    cached -= size;
+                }
+            }
+            if(base == nullptr)
+                base = static_cast<char*>(systemAllocate(size));
+
+            Arena *arena = new Arena{base, size, 0, 0, true};
+            std::lock_guard<std::mutex> lock(mutex);
+            auto next = std::upper_bound(arenas.begin(), arenas.end(), arena->base,
+                                         [](const char *q, const Arena *a) { return q < a->base; });
+            arenas.insert(next, arena);
+            return arena;
+        }
+
+        void closeArena(Arena *arena) noexcept {
+            std::lock_guard<std::mutex> lock(mutex);
+            arena->open = false;
+            if(arena->live == 0)
+                for(size_t k = 0; k < arenas.size(); k++)
+                    if(arenas[k] == arena) {
+                        freeArena(k);
+                        return;
+                    }
+        }
+
+        // Arena the calling thread allocates from, nullptr for the size classes.
+        static inline thread_local Arena *active = nullptr;
+
+        // Returns all cached blocks to the system.
+        void trim() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto &[size, blocks] : freeBlocks) {
+                for(void *block : blocks)
+                    std::free(block);
+                blocks.clear();
+            }
+            cached = 0;
+        }
+
+        // Bytes held in the size classes for reuse.
+        size_t cachedBytes() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return cached;
+        }
+
+        // Rounds up to 256 bytes or to a quarter of the next lower power of two.
+        static size_t sizeClass(size_t bytes) {
+            if(bytes <= 256)
+                return 256;
+            size_t power = size_t(1) << (63 - __builtin_clzll(bytes - 1));
+            size_t step = power / 4;
+            return ((bytes + step - 1) / step) * step;
+        }
+
+    private:
+        // aligned_alloc needs a multiple of the alignment, so huge blocks are
+        // rounded up to whole huge pages.
+        void* systemAllocate(size_t size) {
+            bool huge = hugePages && (size >= hugePageSize);
+            if(huge)
+                size = ((size + hugePageSize - 1) / hugePageSize) * hugePageSize;
+            void *block = std::aligned_alloc(huge ? hugePageSize : alignment, size);
+            if(block == nullptr)
+                throw std::bad_alloc();
+            if(huge)
+                madvise(block, size, MADV_HUGEPAGE);
+            return block;
+        }
+
+        // Returns the block of a finished arena to its size class.
+        void freeArena(size_t k) noexcept {
+            freeBlocks[arenas[k]->capacity].push_back(arenas[k]->base);
+            cached += arenas[k]->capacity;
+            delete arenas[k];
+            arenas.erase(arenas.begin() + k);
+        }
+
+        BufferPool() : cached(0) {
+            const char *huge = std::getenv("FLOW_HUGEPAGES");
+            hugePages = (huge != nullptr) && (huge[0] == '1');
+        }
+
+        std::mutex mutex;
+        std::unordered_map<size_t, std::vector<void*>> freeBlocks;
+        std::vector<Arena*> arenas;
+        size_t cached;
+        bool hugePages;
+};
+
+// Contiguous block for buffers that live and die together, such as the levels
+// of a pyramid. Allocations of this thread inside a Scope are carved from the
+// arena in order; once it is full they fall back to the size classes. The
+// block returns to the pool when the arena and all buffers carved from it are
+// gone.
+class BufferArena
+{
+    public:
+        BufferArena() = delete;
+
+        explicit BufferArena(size_t bytes) :
+            arena(BufferPool::instance().openArena(bytes)) { }
+
+        BufferArena(const BufferArena &) = delete;
+        BufferArena& operator=(const BufferArena &) = delete;
+
+        ~BufferArena() {
+            BufferPool::instance().closeArena(arena);
+        }
+
+        // Space a buffer of bytes takes in an arena.
+        static size_t footprint(size_t bytes) {
+            return ((bytes + BufferPool::alignment - 1) / BufferPool::alignment) * BufferPool::alignment;
+        }
+
+        class Scope
+        {
+            public:
+                explicit Scope(BufferArena &arena) :
+                    previous(BufferPool::active)
+                {
+                    BufferPool::active = arena.arena;
+                }
+
+                Scope(const Scope &) = delete;
+                Scope& operator=(const Scope &) = delete;
+
+                ~Scope() {
+                    BufferPool::active = previous;
+                }
+
+            private:
+                BufferPool::Arena *previous;
+        };
+
+    private:
+        BufferPool::Arena *arena;
+};
+
+// Allocator drawing from BufferPool. Elements constructed without arguments
+// are default-initialised, so std::vector<float, PoolAllocator<float>>(n)
+// leaves the memory untouched and the first write (usually a parallel loop)
+// is also its first touch.
+template< class T >
+class PoolAllocator
+{
+    public:
+        using value_type = T;
+
+        PoolAllocator() noexcept = default;
+
+        template< class U >
+        PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(BufferPool::instance().allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T *p, size_t n) noexcept {
+            BufferPool::instance().release(p, n * sizeof(T));
+        }
+
+        template< class U >
+        void construct(U *p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+            ::new(static_cast<void*>(p)) U;
+        }
+
+        template< class U, class... Args >
+        void construct(U *p, Args&&... args) {
+            ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+        }
+
+        template< class U >
+        bool operator==(const PoolAllocator<U> &) const noexcept {
+            return true;
+        }
+};
+
+template< class T >
+using AlignedVector = std::vector<T, PoolAllocator<T>>;
+
+// Tag for constructors that leave the storage uninitialised.
+struct Uninitialized {};
+inline constexpr Uninitialized uninitialized{};
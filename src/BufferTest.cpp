@@ -0,0 +1,128 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "Buffer.hpp"
+
+void check(bool condition, const std::string& msg)
+{
+    if (!condition)
+    {
+        std::cout << "FAILED: " << msg << "\n";
+    }
+    else
+    {
+        std::cout << "PASSED: " << msg << "\n";
+    }
+}
+
+void test_sizeClass(std::vector< std::pair< bool, std::string > >& results)
+{
+    const std::vector< std::pair< size_t, size_t > > classes = {
+        {1, 256}, {256, 256}, {257, 320}, {320, 320}, {321, 384}, {512, 512},
+        {513, 640}, {1000, 1024}, {1025, 1280}, {(size_t(1) << 20) + 1, (size_t(1) << 20) + (size_t(1) << 18)},
+    };
+    for (auto [bytes, expected] : classes)
+        results.push_back({BufferPool::sizeClass(bytes) == expected,
+                           "test_sizeClass: " + std::to_string(bytes) + " bytes round to " + std::to_string(expected)});
+
+    bool bounded = true;
+    for (size_t bytes = 1; bytes < (size_t(1) << 16); bytes++) {
+        size_t size = BufferPool::sizeClass(bytes);
+        bounded = bounded && (size >= bytes) && (size % BufferPool::alignment == 0) && ((bytes <= 256) || (4 * size < 5 * bytes + 4 * 256));
+    }
+    results.push_back({bounded, "test_sizeClass: classes are aligned and at most 25% larger"});
+}
+
+void test_recycling(std::vector< std::pair< bool, std::string > >& results)
+{
+    BufferPool &pool = BufferPool::instance();
+    pool.trim();
+
+    void *block = pool.allocate(1000);
+    results.push_back({reinterpret_cast<uintptr_t>(block) % BufferPool::alignment == 0, "test_recycling: blocks are aligned"});
+    pool.release(block, 1000);
+    results.push_back({pool.cachedBytes() == 1024, "test_recycling: released block is cached in its class"});
+    results.push_back({pool.allocate(900) == block, "test_recycling: same class reuses the block"});
+    results.push_back({pool.cachedBytes() == 0, "test_recycling: reused block leaves the cache"});
+    pool.release(block, 900);
+    pool.trim();
+    results.push_back({pool.cachedBytes() == 0, "test_recycling: trim empties the cache"});
+}
+
+void test_arena(std::vector< std::pair< bool, std::string > >& results)
+{
+    BufferPool &pool = BufferPool::instance();
+    pool.trim();
+
+    std::vector< char* > carved;
+    char *outside;
+    {
+        BufferArena arena(3 * BufferArena::footprint(100));
+        BufferArena::Scope scope(arena);
+        for (size_t k = 0; k < 3; k++)
+            carved.push_back(static_cast<char*>(pool.allocate(100)));
+        outside = static_cast<char*>(pool.allocate(100));
+    }
+    results.push_back({(carved[1] == carved[0] + 128) && (carved[2] == carved[1] + 128),
+                       "test_arena: allocations are carved consecutively"});
+    results.push_back({(outside < carved[0]) || (outside >= carved[0] + 384), "test_arena: a full arena falls back to the classes"});
+
+    for (char *block : carved)
+        pool.release(block, 100);
+    results.push_back({pool.cachedBytes() == BufferPool::sizeClass(384),
+                       "test_arena: carved blocks are not cached, the arena's block is"});
+    pool.release(outside, 100);
+    results.push_back({pool.cachedBytes() == BufferPool::sizeClass(384) + 256, "test_arena: blocks outside the arena are cached"});
+
+    // The next arena of the same size reuses the block.
+    {
+        BufferArena arena(3 * BufferArena::footprint(100));
+        BufferArena::Scope scope(arena);
+        char *reused = static_cast<char*>(pool.allocate(100));
+        results.push_back({reused == carved[0], "test_arena: a closed arena's block is reused by the next one"});
+        pool.release(reused, 100);
+    }
+    pool.trim();
+
+    // Two arenas at once, released in either order.
+    BufferArena *first = new BufferArena(1024);
+    BufferArena *second = new BufferArena(1024);
+    void *a, *b;
+    {
+        BufferArena::Scope scope(*first);
+        a = pool.allocate(64);
+    }
+    {
+        BufferArena::Scope scope(*second);
+        b = pool.allocate(64);
+    }
+    delete first;
+    delete second;
+    pool.release(b, 64);
+    pool.release(a, 64);
+    results.push_back({pool.cachedBytes() == 2 * BufferPool::sizeClass(1024), "test_arena: blocks find their arena among several"});
+    pool.trim();
+}
+
+int main()
+{
+    std::vector< std::pair< bool, std::string > > results;
+
+    test_sizeClass(results);
+    test_recycling(results);
+    test_arena(results);
+
+    size_t passed = 0;
+    for (auto [condition, msg] : results)
+    {
+        check(condition, msg);
+        if (condition)
+        {
+            passed++;
+        }
+    }
+
+    std::cout << "--- " << passed << "/" << results.size() << " checks passed ---" << std::endl;
+
+    return passed != results.size();
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+#include "Operator.hpp"
+
+// Direct solver for the coupled Horn-Schunck system of a small level. The
+// interior unknowns are numbered cell by cell in column-major order with u and
+// v of a cell next to each other, which makes the SPD system matrix banded
+// with bandwidth 2 * (rows - 2). It is factorised once by a banded Cholesky
+// decomposition in double precision; the ghost layer of phi enters the
+// right-hand side as a Dirichlet boundary. Runs on the calling thread only.
+class CoarseSolver
+{
+    public:
+        CoarseSolver() = default;
+
+        // True if the factorisation belongs to a level of this shape and alpha.
+        inline bool matches(size_t rows, size_t cols, float alpha) const {
+            return (factorised && (rows == (m + 2)) && (cols == (n + 2)) && (alpha == factorAlpha));
+        }
+
+        // Drops the factorisation, e.g. when the coefficients have changed.
+        inline void reset() {
+            factorised = false;
+        }
+
+        // Assembles and factorises the system of operator A on a level of the given shape.
+        template< class Operator >
+        void factorise(const Operator &A, size_t rows, size_t cols) {
+            const float alpha = A.weight();
+            m = rows - 2;
+            n = cols - 2;
+            bandwidth = 2 * m;
+            size_t N = 2 * m * n;
+            size_t width = bandwidth + 1;
+            band.assign(N * width, 0.);
+            rhs.assign(N, 0.);
+
+            // Lower band of the system matrix, band[k * width + d] = A(k, k - d).
+            for(size_t j = 1; j <= n; j++)
+                for(size_t i = 1; i <= m; i++) {
+                    size_t k = index(i, j);
+                    band[k * width] = A.diagU(i, j);
+                    band[(k + 1) * width] = A.diagV(i, j);
+                    band[(k + 1) * width + 1] = A.cross(i, j);
+                    if(i > 1) {
+                        band[k * width + 2] = -alpha;
+                        band[(k + 1) * width + 2] = -alpha;
+                    }
+                    if(j > 1) {
+                        band[k * width + bandwidth] = -alpha;
+                        band[(k + 1) * width + bandwidth] = -alpha;
+                    }
+                }
+
+            // In-place Cholesky factorisation A = L * L^T within the band.
+            for(size_t k = 0; k < N; k++) {
+                size_t first = (k > bandwidth) ? (k - bandwidth) : 0;
+                for(size_t col = first; col <= k; col++) {
+                    size_t start = (col > bandwidth) ? std::max(first, col - bandwidth) : first;
+                    double sum = band[k * width + (k - col)];
+                    for(size_t p = start; p < col; p++)
+                        sum -= band[k * width + (k - p)] * band[col * width + (col - p)];
+
+                    if(col == k)
+                        band[k * width] = std::sqrt(sum);
+                    else
+                        band[k * width + (k - col)] = sum / band[col * width];
+                }
+            }
+
+            factorAlpha = alpha;
+            factorised = true;
+        }
+
+        // Solves the interior of phi exactly for the right-hand side f.
+        template< FlowLayout Flow >
+        void solve(Flow &phi, const Flow &f) {
+            const float alpha = factorAlpha;
+            size_t N = 2 * m * n;
+            size_t width = bandwidth + 1;
+
+            for(size_t j = 1; j <= n; j++)
+                for(size_t i = 1; i <= m; i++) {
+                    double bu = f.u(i, j);
+                    double bv = f.v(i, j);
+                    if(i == 1) { bu += alpha * phi.u(0, j);       bv += alpha * phi.v(0, j); }
+                    if(i == m) { bu += alpha * phi.u(m + 1, j);   bv += alpha * phi.v(m + 1, j); }
+                    if(j == 1) { bu += alpha * phi.u(i, 0);       bv += alpha * phi.v(i, 0); }
+                    if(j == n) { bu += alpha * phi.u(i, n + 1);   bv += alpha * phi.v(i, n + 1); }
+                    rhs[index(i, j)] = bu;
+                    rhs[index(i, j) + 1] = bv;
+                }
+
+            // L * y = b
+            for(size_t k = 0; k < N; k++) {
+                size_t first = (k > bandwidth) ? (k - bandwidth) : 0;
+                double sum = rhs[k];
+                for(size_t p = first; p < k; p++)
+                    sum -= band[k * width + (k - p)] * rhs[p];
+                rhs[k] = sum / band[k * width];
+            }
+
+            // L^T * x = y
+            for(size_t k = N; k-- > 0;) {
+                size_t last = std::min(N - 1, k + bandwidth);
+                double sum = rhs[k];
+                for(size_t p = k + 1; p <= last; p++)
+                    sum -= band[p * width + (p - k)] * rhs[p];
+                rhs[k] = sum / band[k * width];
+            }
+
+            for(size_t j = 1; j <= n; j++)
+                for(size_t i = 1; i <= m; i++) {
+                    phi.u(i, j) = rhs[index(i, j)];
+                    phi.v(i, j) = rhs[index(i, j) + 1];
+                }
+        }
+
+    private:
+        inline size_t index(size_t i, size_t j) const {
+            return 2 * (m * (j - 1) + (i - 1));
+        }
+
+        size_t m = 0;
+        size_t n = 0;
+        size_t bandwidth = 0;
+        float factorAlpha = 0.;
+        bool factorised = false;
+        std::vector<double> band;
+        std::vector<double> rhs;
+};
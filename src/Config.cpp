@@ -0,0 +1,286 @@
+#include "Config.hpp"
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <type_traits>
+#include <iostream>
+
+using namespace std;
+
+static bool parseCycle(const string &value, CycleType &cycle)
+{
+    if(value == "V")
+        cycle = CycleType::V;
+    else if(value == "F")
+        cycle = CycleType::F;
+    else if(value == "W")
+        cycle = CycleType::W;
+    else if(value == "FMG")
+        cycle = CycleType::FMG;
+    else
+        return false;
+    return true;
+}
+
+static bool parseSmoother(const string &value, Smoother &smoother)
+{
+    if(value == "block")
+        smoother = Smoother::Block;
+    else if(value == "rbgs")
+        smoother = Smoother::RedBlack;
+    else
+        return false;
+    return true;
+}
+
+static bool parseSolver(const string &value, SolverType &solver)
+{
+    if(value == "mg")
+        solver = SolverType::Multigrid;
+    else if(value == "cg")
+        solver = SolverType::CG;
+    else
+        return false;
+    return true;
+}
+
+static bool parsePreconditioner(const string &value, Preconditioner &preconditioner)
+{
+    if(value == "none")
+        preconditioner = Preconditioner::None;
+    else if(value == "jacobi")
+        preconditioner = Preconditioner::Jacobi;
+    else if(value == "mg")
+        preconditioner = Preconditioner::Multigrid;
+    else
+        return false;
+    return true;
+}
+
+static bool parsePyramid(const string &value, Pyramid &pyramid)
+{
+    if(value == "derivatives")
+        pyramid = Pyramid::Derivatives;
+    else if(value == "images")
+        pyramid = Pyramid::Images;
+    else
+        return false;
+    return true;
+}
+
+static bool parseWarmStart(const string &value, WarmStart &warmStart)
+{
+    if(value == "none")
+        warmStart = WarmStart::None;
+    else if(value == "previous")
+        warmStart = WarmStart::Previous;
+    else if(value == "warped")
+        warmStart = WarmStart::Warped;
+    else
+        return false;
+    return true;
+}
+
+// Parses the whole of value into the type of number. Integers take no sign
+// or fraction, so "-1", "1.5" and out-of-range values are rejected instead of
+// being converted; floating-point values must be finite and non-negative.
+template< class T >
+static bool parseNumber(const string &value, T &number)
+{
+    T parsed = 0;
+    auto [end, error] = from_chars(value.data(), value.data() + value.size(), parsed);
+    if(value.empty() || (error != errc()) || (end != value.data() + value.size()))
+        return false;
+    if constexpr (is_floating_point_v<T>) {
+        if(!isfinite(parsed) || (parsed < 0))
+            return false;
+    }
+    number = parsed;
+    return true;
+}
+
+// Comma-separated positive integers, e.g. "8,4,1".
+static bool parseThreadList(const string &value, vector<size_t> &threads)
+{
+    vector<size_t> parsed;
+    size_t position = 0;
+    while(position <= value.size()) {
+        size_t comma = value.find(',', position);
+        string item = value.substr(position, (comma == string::npos) ? string::npos : comma - position);
+        size_t count = 0;
+        if(!parseNumber(item, count) || (count == 0))
+            return false;
+        parsed.push_back(count);
+        if(comma == string::npos)
+            break;
+        position = comma + 1;
+    }
+    threads = parsed;
+    return true;
+}
+
+// Switches accept no value (on), 1 or 0.
+static bool parseFlag(const string &value, bool &flag)
+{
+    if((value != "") && (value != "0") && (value != "1"))
+        return false;
+    flag = (value != "0");
+    return true;
+}
+
+
+// Applies one name=value setting; returns false for unknown names or values.
+static bool apply(SolverConfig &config, const string &name, const string &value)
+{
+    if(name == "solver")
+        return parseSolver(value, config.solver);
+    if(name == "precond")
+        return parsePreconditioner(value, config.preconditioner);
+    if(name == "cycle")
+        return parseCycle(value, config.cycle);
+    if(name == "smoother")
+        return parseSmoother(value, config.smoother);
+    if(name == "pre")
+        return parseNumber(value, config.preSmoothing);
+    if(name == "post")
+        return parseNumber(value, config.postSmoothing);
+    if(name == "coarse")
+        return parseNumber(value, config.coarsestSmoothing);
+    if(name == "direct")
+        return parseNumber(value, config.directSolveCells);
+    if(name == "alpha") {
+        float alpha;
+        if(!parseNumber(value, alpha) || !(alpha > 0) || !std::isfinite(alpha))
+            return false;
+        config.alpha = alpha;
+        return true;
+    }
+    if(name == "pyramid")
+        return parsePyramid(value, config.pyramid);
+    if(name == "tol")
+        return parseNumber(value, config.tolerance);
+    if(name == "rtol")
+        return parseNumber(value, config.relativeTolerance);
+    if(name == "max-cycles")
+        return parseNumber(value, config.maxCycles);
+    if(name == "stagnation")
+        return parseNumber(value, config.stagnationFactor);
+    if(name == "stagnation-window")
+        return parseNumber(value, config.stagnationWindow);
+    if(name == "norm") {
+        if((value != "exact") && (value != "lagged"))
+            return false;
+        config.laggedNorm = (value == "lagged");
+        return true;
+    }
+    if(name == "threads")
+        return parseThreadList(value, config.levelThreads);
+    if(name == "ftz")
+        return parseFlag(value, config.flushDenormals);
+    if(name == "refine")
+        return parseFlag(value, config.refine);
+    if(name == "compare")
+        return parseFlag(value, config.compare);
+    if(name == "history") {
+        config.historyPath = value;
+        return !value.empty();
+    }
+    if(name == "sequence")
+        return parseFlag(value, config.sequence);
+    if(name == "warm-start")
+        return parseWarmStart(value, config.warmStart);
+    if(name == "output") {
+        config.outputPrefix = value;
+        return !value.empty();
+    }
+    return false;
+}
+
+static const vector<pair<string, string>> environment = {
+    {"solver", "FLOW_SOLVER"},
+    {"precond", "FLOW_PRECOND"},
+    {"cycle", "FLOW_CYCLE"},
+    {"smoother", "FLOW_SMOOTHER"},
+    {"pre", "FLOW_PRE"},
+    {"post", "FLOW_POST"},
+    {"coarse", "FLOW_COARSE"},
+    {"direct", "FLOW_DIRECT"},
+    {"alpha", "FLOW_ALPHA"},
+    {"pyramid", "FLOW_PYRAMID"},
+    {"tol", "FLOW_TOL"},
+    {"rtol", "FLOW_RTOL"},
+    {"max-cycles", "FLOW_MAX_CYCLES"},
+    {"stagnation", "FLOW_STAGNATION"},
+    {"stagnation-window", "FLOW_STAGNATION_WINDOW"},
+    {"norm", "FLOW_NORM"},
+    {"threads", "FLOW_THREADS"},
+    {"ftz", "FLOW_FTZ"},
+    {"refine", "FLOW_REFINE"},
+    {"compare", "FLOW_COMPARE"},
+    {"history", "FLOW_HISTORY"},
+    {"sequence", "FLOW_SEQUENCE"},
+    {"output", "FLOW_OUTPUT"},
+    {"warm-start", "FLOW_WARM_START"},
+};
+
+SolverConfig parseConfig(int argc, char *argv[], vector<string> &positional)
+{
+    SolverConfig config;
+
+    for(const auto &[name, variable] : environment) {
+        const char *value = getenv(variable.c_str());
+        if((value != nullptr) && !apply(config, name, value))
+            cout << "Ignoring invalid " << variable << "=" << value << endl;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        string argument = argv[i];
+        if(argument.rfind("--", 0) != 0) {
+            positional.push_back(argument);
+            continue;
+        }
+
+        size_t split = argument.find('=');
+        string name = argument.substr(2, split - 2);
+        string value = (split == string::npos) ? "" : argument.substr(split + 1);
+        if(!apply(config, name, value))
+            cout << "Ignoring invalid option " << argument << endl;
+    }
+
+    if(!config.sequence && positional.size() > 4 && !parseCycle(positional[4], config.cycle))
+        cout << "Unknown cycle " << positional[4] << ", using F" << endl;
+
+    return config;
+}
+
+string usage()
+{
+    return "usage: flow <image0> <image1> [<outU> <outV>] [V|F|W|FMG] [options]\n"
+           "       flow --sequence <frame0> <frame1> ... <frameN> [options]\n"
+           "  --solver=mg|cg           multigrid cycles or preconditioned CG (FLOW_SOLVER, default mg)\n"
+           "  --precond=none|jacobi|mg CG preconditioner, mg = one V-cycle (FLOW_PRECOND, default mg)\n"
+           "  --cycle=V|F|W|FMG        multigrid cycle (FLOW_CYCLE, default F)\n"
+           "  --smoother=block|rbgs    smoother (FLOW_SMOOTHER, default block)\n"
+           "  --pre=N --post=N         pre-/post-smoothing sweeps (FLOW_PRE, FLOW_POST, default 5)\n"
+           "  --coarse=N               coarsest-level sweeps without direct solve (FLOW_COARSE, default 5)\n"
+           "  --direct=CELLS           direct solve below this level size, 0 = off (FLOW_DIRECT, default 1024)\n"
+           "  --alpha=A                regularisation weight (FLOW_ALPHA, default 1)\n"
+           "  --pyramid=derivatives|images  coarse derivatives restricted, or taken from restricted frames\n"
+           "                           (FLOW_PYRAMID, default derivatives)\n"
+           "  --tol=T                  absolute residual tolerance (FLOW_TOL, default 5e-4)\n"
+           "  --rtol=R                 tolerance relative to the initial residual (FLOW_RTOL, default off)\n"
+           "  --max-cycles=N           cycle limit (FLOW_MAX_CYCLES, default 10000)\n"
+           "  --stagnation=F           stop if the mean factor of the window exceeds F (FLOW_STAGNATION, default 0.98)\n"
+           "  --stagnation-window=N    cycles in that window, 0 = off (FLOW_STAGNATION_WINDOW, default 0)\n"
+           "  --norm=exact|lagged      residual norm per cycle or from the next restriction (FLOW_NORM, default exact)\n"
+           "  --threads=N[,N...]       thread count per level from the finest, last one repeated (FLOW_THREADS)\n"
+           "  --ftz=0|1                flush denormals to zero on all threads (FLOW_FTZ, default 1)\n"
+           "  --refine                 double-precision refinement around float cycles (FLOW_REFINE=1)\n"
+           "  --compare                difference to the reference flow <image>_ref_{u,v}.bmp (FLOW_COMPARE=1)\n"
+           "  --history=FILE           residual history, JSON for *.json, CSV otherwise (FLOW_HISTORY);\n"
+           "                           in sequence mode FILE_<k> per pair\n"
+           "  --sequence               flow of every consecutive frame pair, each frame loaded once (FLOW_SEQUENCE=1)\n"
+           "  --output=PREFIX          sequence output <PREFIX>U<k>.bmp, <PREFIX>V<k>.bmp (FLOW_OUTPUT, default result)\n"
+           "  --warm-start=none|previous|warped  sequence initial guess: zero, previous flow, or previous flow\n"
+           "                           propagated along itself (FLOW_WARM_START, default none)\n";
+}
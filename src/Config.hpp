@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef CONFIG
+#define CONFIG
+
+#include <string>
+#include <vector>
+#include "solver.hpp"
+
+enum class CycleType { V, F, W, FMG };
+enum class SolverType { Multigrid, CG };
+enum class Preconditioner { None, Jacobi, Multigrid };
+enum class WarmStart { None, Previous, Warped };
+
+// Runtime parameters of the solver. Every field can be set through an
+// environment variable (FLOW_<NAME>) and overridden by a command-line
+// option (--<name>=<value>), see usage().
+struct SolverConfig
+{
+    SolverType solver = SolverType::Multigrid;
+    // Preconditioner of the CG solver; Multigrid applies one V-cycle.
+    Preconditioner preconditioner = Preconditioner::Multigrid;
+    CycleType cycle = CycleType::F;
+    Smoother smoother = Smoother::Block;
+    size_t preSmoothing = 5;
+    size_t postSmoothing = 5;
+    size_t coarsestSmoothing = 5;
+    // Coarse levels with at most this many cells (ghost layer included) are
+    // solved directly on one thread; 0 smooths the coarsest level instead.
+    size_t directSolveCells = 1024;
+    float alpha = 1.0f;
+    // Coarse derivatives from restricted derivatives or restricted frames.
+    Pyramid pyramid = Pyramid::Derivatives;
+    // Stop once the residual norm is below tolerance or below
+    // relativeTolerance times the initial residual norm (0 disables it).
+    double tolerance = 0.0005;
+    double relativeTolerance = 0.;
+    size_t maxCycles = 10000;
+    // Stop when the mean convergence factor over the last stagnationWindow
+    // cycles is above stagnationFactor. Off (window 0) by default: a slow
+    // stretch of a non-monotone residual would end a run that still converges.
+    double stagnationFactor = 0.98;
+    size_t stagnationWindow = 0;
+    // Exact: evaluate the residual norm after every cycle in one fused pass.
+    // Lagged: reuse the norm computed by the first restriction of the cycle,
+    // which belongs to the solution after its pre-smoothing; saves that pass
+    // but detects convergence about one cycle late.
+    bool laggedNorm = false;
+    // Mixed-precision iterative refinement around the multigrid cycles:
+    // solution and residual in double, cycles in float.
+    bool refine = false;
+    // Report the L2 / Linf difference to test_images/<name>_ref_{u,v}.bmp.
+    bool compare = false;
+    // Thread count per level from the finest, the last entry repeated;
+    // empty: chosen by LevelScheduler.
+    std::vector<size_t> levelThreads;
+    // Flush denormals to zero on all threads (process-wide, set up by main).
+    bool flushDenormals = true;
+    // Residual history output, JSON for a ".json" path, CSV otherwise.
+    std::string historyPath;
+    // Sequence mode: the positional arguments are frames f0 f1 ... fn and the
+    // flow of every pair (fk, fk+1) is written to <outputPrefix>{U,V}<k>.bmp.
+    bool sequence = false;
+    std::string outputPrefix = "result";
+    // Initial guess of every pair after the first in sequence mode: zero,
+    // the previous pair's flow, or that flow propagated along itself.
+    WarmStart warmStart = WarmStart::None;
+};
+
+// Builds the configuration from the environment and argv. Arguments not
+// starting with "--" are returned in positional; outside sequence mode an
+// additional positional V/F/W/FMG after the output names selects the cycle
+// as before.
+SolverConfig parseConfig(int argc, char *argv[], std::vector<std::string> &positional);
+
+std::string usage();
+
+#endif
@@ -0,0 +1,101 @@
+#include "Convergence.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+ConvergenceMonitor::ConvergenceMonitor(const SolverConfig &config, double initialResidual) :
+    config(config),
+    initial(initialResidual),
+    target(max(config.tolerance, config.relativeTolerance * initialResidual)),
+    stop(StopReason::None)
+{ }
+
+bool ConvergenceMonitor::record(double residual, double linf, double seconds)
+{
+    double previous = entries.empty() ? initial : entries.back().residual;
+    double factor = (previous > 0) ? (residual / previous) : 0.;
+    entries.push_back({entries.size() + 1, residual, linf, factor, seconds});
+
+    // CG residuals are not monotone, a window of slow steps says nothing
+    // about convergence there.
+    size_t window = (config.solver == SolverType::CG) ? 0 : config.stagnationWindow;
+    if(!isfinite(residual))
+        stop = StopReason::Diverged;
+    else if(residual < config.tolerance)
+        stop = StopReason::Tolerance;
+    else if(residual < target)
+        stop = StopReason::Relative;
+    else if((window > 0) && (entries.size() > window)) {
+        double before = entries[entries.size() - 1 - window].residual;
+        if(pow(residual / before, 1. / window) > config.stagnationFactor)
+            stop = StopReason::Stagnation;
+    }
+    if((stop == StopReason::None) && (entries.size() >= config.maxCycles))
+        stop = StopReason::MaxCycles;
+
+    return stop != StopReason::None;
+}
+
+double ConvergenceMonitor::meanFactor() const
+{
+    if(entries.empty() || (initial <= 0))
+        return 0.;
+    return pow(entries.back().residual / initial, 1. / entries.size());
+}
+
+// JSON has no literal for NaN or infinity.
+static string jsonNumber(double value)
+{
+    if(!isfinite(value))
+        return "null";
+    ostringstream out;
+    out << setprecision(9) << value;
+    return out.str();
+}
+
+bool ConvergenceMonitor::write(const string &path) const
+{
+    ofstream out(path);
+    if(!out)
+        return false;
+    out << setprecision(9);
+
+    bool json = (path.size() >= 5) && (path.compare(path.size() - 5, 5, ".json") == 0);
+    if(json) {
+        out << "{\n  \"stop\": \"" << toString(stop) << "\",\n"
+            << "  \"initialResidual\": " << jsonNumber(initial) << ",\n"
+            << "  \"meanFactor\": " << jsonNumber(meanFactor()) << ",\n"
+            << "  \"cycles\": [";
+        for(size_t k = 0; k < entries.size(); k++) {
+            const Entry &e = entries[k];
+            out << ((k == 0) ? "\n" : ",\n")
+                << "    {\"cycle\": " << e.cycle << ", \"residual\": " << jsonNumber(e.residual)
+                << ", \"linf\": " << jsonNumber(e.linf) << ", \"factor\": " << jsonNumber(e.factor)
+                << ", \"seconds\": " << jsonNumber(e.seconds) << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+    else {
+        out << "cycle,residual,linf,factor,seconds\n";
+        for(const Entry &e : entries)
+            out << e.cycle << "," << e.residual << "," << e.linf << "," << e.factor << "," << e.seconds << "\n";
+    }
+
+    return bool(out);
+}
+
+string toString(StopReason reason)
+{
+    switch(reason) {
+        case StopReason::Tolerance:  return "tolerance";
+        case StopReason::Relative:   return "relative";
+        case StopReason::Stagnation: return "stagnation";
+        case StopReason::MaxCycles:  return "max-cycles";
+        case StopReason::Diverged:   return "diverged";
+        default:                     return "none";
+    }
+}
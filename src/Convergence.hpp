@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef CONVERGENCE
+#define CONVERGENCE
+
+#include <string>
+#include <vector>
+#include "Config.hpp"
+
+enum class StopReason { None, Tolerance, Relative, Stagnation, MaxCycles, Diverged };
+
+// Tracks the residual norm per cycle and decides when to stop: below the
+// absolute tolerance, below the relative target, after maxCycles, when the
+// residual is no longer finite, or when the mean convergence factor of the
+// last stagnationWindow cycles exceeds stagnationFactor, i.e. further cycles
+// no longer pay off. The stagnation test is skipped for the CG solver.
+class ConvergenceMonitor
+{
+    public:
+        struct Entry {
+            size_t cycle;
+            double residual;
+            double linf;
+            double factor;
+            double seconds;
+        };
+
+        ConvergenceMonitor() = delete;
+
+        ConvergenceMonitor(const SolverConfig &config, double initialResidual);
+
+        // Records the residual norms (L2 and Linf) after cycle number
+        // history().size() + 1, seconds after the start; returns true if the
+        // solver should stop. Stopping is decided on the L2 norm.
+        bool record(double residual, double linf, double seconds);
+
+        inline StopReason reason() const {
+            return stop;
+        }
+
+        inline const std::vector<Entry>& history() const {
+            return entries;
+        }
+
+        inline double initialResidual() const {
+            return initial;
+        }
+
+        // Geometric mean of all convergence factors so far.
+        double meanFactor() const;
+
+        // Writes the history as JSON if path ends in ".json", as CSV otherwise.
+        // Non-finite values are written as null in JSON.
+        bool write(const std::string &path) const;
+
+    private:
+        const SolverConfig &config;
+        double initial;
+        double target;
+        StopReason stop;
+        std::vector<Entry> entries;
+};
+
+std::string toString(StopReason reason);
+
+#endif
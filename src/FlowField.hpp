@@ -7,50 +7,71 @@
 #include <stdexcept>
 #include <vector>
 #include <cassert>
+#include <type_traits>
 #include <utility>
 
 #include "Matrix.hpp"
 
-class UV
+// Flow field with u and v in separate matrices. BasicUV<double> is used for
+// the solution and residual of the mixed-precision refinement.
+template< class ComponentType >
+class BasicUV
 {
     public:
 
         //constructors
-        UV() = delete;
+        BasicUV() = delete;
 
-        UV(const Matrix<float> &ou, const Matrix<float> &ov) :
+        BasicUV(const Matrix<ComponentType> &ou, const Matrix<ComponentType> &ov) :
             u(ou),
             v(ov)
             { }
 
-        UV(const Matrix<float> &&ou, const Matrix<float> &&ov) :
+        BasicUV(const Matrix<ComponentType> &&ou, const Matrix<ComponentType> &&ov) :
             u(std::move(ou)),
             v(std::move(ov))
             { }
 
-        UV(std::vector<size_t> shape, float init) :
-            u(Matrix<float>(shape[0], shape[1], init)),
-            v(Matrix<float>(shape[0], shape[1], init))
+        BasicUV(std::vector<size_t> shape, ComponentType init) :
+            u(Matrix<ComponentType>(shape[0], shape[1], init)),
+            v(Matrix<ComponentType>(shape[0], shape[1], init))
             { }
 
-        UV(std::vector<size_t> shape, float init, std::vector<size_t> oldShape) :
-            u(Matrix<float>(shape[0], shape[1], init, oldShape)),
-            v(Matrix<float>(shape[0], shape[1], init, oldShape))
+        BasicUV(std::vector<size_t> shape, ComponentType init, std::vector<size_t> oldShape) :
+            u(Matrix<ComponentType>(shape[0], shape[1], init, oldShape)),
+            v(Matrix<ComponentType>(shape[0], shape[1], init, oldShape))
             { }
 
-        UV& operator+=(const UV& rhs) {
+        BasicUV& operator+=(const BasicUV& rhs) {
             this->u += rhs.u;
             this->v += rhs.v;
             return *this; 
         }
 
-        friend UV operator+(UV lhs, const UV& rhs) {
+        friend BasicUV operator+(BasicUV lhs, const BasicUV& rhs) {
             lhs += rhs;
             return lhs;
         }
 
-        Matrix<float> u;
-        Matrix<float> v;
+        Matrix<ComponentType> u;
+        Matrix<ComponentType> v;
+
+        [[nodiscard]] inline size_t rows() const {
+            return u.rows();
+        }
+
+        [[nodiscard]] inline size_t cols() const {
+            return u.cols();
+        }
+
+        inline std::vector<size_t> getShape() const {
+            return u.getShape();
+        }
+
+        // Sum of the L2 norms of both components.
+        inline ComponentType l2Norm() const {
+            return u.l2Norm() + v.l2Norm();
+        }
 
 
         inline void restrict() {
@@ -63,8 +84,24 @@ class UV
             this->v = std::move(v.prolongate());
         }
 
-        inline UV prolongate() {
-            return UV(std::move(u.prolongate()), std::move(v.prolongate()));
+        inline BasicUV prolongate() {
+            return BasicUV(std::move(u.prolongate()), std::move(v.prolongate()));
+        }
+
+        inline void restrictInto(BasicUV &coarse) const {
+            u.restrictInto(coarse.u);
+            v.restrictInto(coarse.v);
+        }
+
+        // Adds the prolongated coarse correction to *this.
+        inline void prolongateAdd(const BasicUV &coarse) {
+            u.prolongateAdd(coarse.u);
+            v.prolongateAdd(coarse.v);
+        }
+
+        inline void fill(ComponentType value) {
+            u.fill(value);
+            v.fill(value);
         }
 
         inline void normalize() {
@@ -117,12 +154,12 @@ class UV
                 return -1.f;
             }
 
-            Matrix<float> uRef(pathRefU.c_str());
-            Matrix<float> vRef(pathRefV.c_str());
+            Matrix<ComponentType> uRef(pathRefU.c_str());
+            Matrix<ComponentType> vRef(pathRefV.c_str());
             uRef = (uRef * 2.f) + (-1.f);
             vRef = (vRef * 2.f) + (-1.f);
-            Matrix<float> uDiff = uRef + (u * (-1.f));
-            Matrix<float> vDiff = vRef + (v * (-1.f));
+            Matrix<ComponentType> uDiff = uRef + (u * (-1.f));
+            Matrix<ComponentType> vDiff = vRef + (v * (-1.f));
 
             uDiff.writeToImage("uDiff.bmp");
             vDiff.writeToImage("vDiff.bmp");
@@ -136,4 +173,175 @@ class UV
             u.writeToImage(pathU);
             v.writeToImage(pathV);
         }
-};
\ No newline at end of file
+};
+
+using UV = BasicUV<float>;
+
+// Flow field storing (u, v) pairs next to each other, so the smoother and
+// the residual read one stream instead of two. Cells are column-major like
+// Matrix and carry the same one-cell ghost layer.
+class InterleavedUV
+{
+    public:
+
+        //constructors
+        InterleavedUV() = delete;
+
+        InterleavedUV(std::vector<size_t> shape, float init) :
+            InterleavedUV(shape, init, shape)
+            { }
+
+        InterleavedUV(std::vector<size_t> shape, float init, std::vector<size_t> oldShape) :
+            shape(shape),
+            originalShape(oldShape),
+            buffer(AlignedVector<float>(2 * shape[0] * shape[1]))
+        {
+            fill(init);
+        }
+
+        explicit InterleavedUV(const UV &split) :
+            InterleavedUV(split.getShape(), 0.0)
+        {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < cols(); j++)
+                for(size_t i = 0; i < rows(); i++) {
+                    u(i, j) = split.u(i, j);
+                    v(i, j) = split.v(i, j);
+                }
+        }
+
+        [[nodiscard]] inline size_t rows() const {
+            return shape[0];
+        }
+
+        [[nodiscard]] inline size_t cols() const {
+            return shape[1];
+        }
+
+        inline std::vector<size_t> getShape() const {
+            return shape;
+        }
+
+        inline std::vector<size_t> getOriginalShape() const {
+            return originalShape;
+        }
+
+        inline const float& u(size_t row, size_t col) const {
+            return buffer[2 * (shape[0] * col + row)];
+        }
+
+        inline float& u(size_t row, size_t col) {
+            return buffer[2 * (shape[0] * col + row)];
+        }
+
+        inline const float& v(size_t row, size_t col) const {
+            return buffer[2 * (shape[0] * col + row) + 1];
+        }
+
+        inline float& v(size_t row, size_t col) {
+            return buffer[2 * (shape[0] * col + row) + 1];
+        }
+
+        inline void fill(float value) {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < cols(); j++)
+                for(size_t i = 0; i < 2 * rows(); i++)
+                    buffer[2 * shape[0] * j + i] = value;
+        }
+
+        // Full-weighting restriction into the interior of coarse, see Matrix::restrictInto.
+        inline void restrictInto(InterleavedUV &coarse) const {
+
+            assert(coarse.rows() == ((rows() - 2) / 2) + 2);
+            assert(coarse.cols() == ((cols() - 2) / 2) + 2);
+
+            #pragma omp parallel for schedule(static)
+            for (size_t col = 1; col < coarse.cols() - 1; col += 1)
+                for (size_t row = 1; row < coarse.rows() - 1; row += 1) {
+                    size_t i = 2 * row, j = 2 * col;
+                    coarse.u(row, col) = u(i, j) / 4
+                        + (u(i, j - 1) + u(i, j + 1) + u(i - 1, j) + u(i + 1, j)) / 8
+                        + (u(i - 1, j - 1) + u(i - 1, j + 1) + u(i + 1, j - 1) + u(i + 1, j + 1)) / 16;
+                    coarse.v(row, col) = v(i, j) / 4
+                        + (v(i, j - 1) + v(i, j + 1) + v(i - 1, j) + v(i + 1, j)) / 8
+                        + (v(i - 1, j - 1) + v(i - 1, j + 1) + v(i + 1, j - 1) + v(i + 1, j + 1)) / 16;
+                }
+        }
+
+        // Adds the prolongated coarse correction to *this in one pass over
+        // both components, summed in the same order as Matrix::prolongateAdd.
+        inline void prolongateAdd(const InterleavedUV &coarse) {
+
+            assert((2 * (coarse.rows() - 2) + 1) < rows());
+            assert((2 * (coarse.cols() - 2) + 1) < cols());
+
+            prolongateAddGather< Pair, float >(coarse.rows(), coarse.cols(),
+                [&](size_t i, size_t j) { return Pair{coarse.u(i, j), coarse.v(i, j)}; },
+                [&](size_t i, size_t j, const Pair &value) { u(i, j) += value.u; v(i, j) += value.v; });
+        }
+
+        // Sum of the L2 norms of both components.
+        inline float l2Norm() const {
+            float normU = 0., normV = 0.;
+
+            #pragma omp parallel for schedule(static) reduction(+:normU, normV)
+            for (size_t j = 1; j < cols() - 1; j++)
+                for (size_t i = 1; i < rows() - 1; i++) {
+                    normU += u(i, j) * u(i, j);
+                    normV += v(i, j) * v(i, j);
+                }
+
+            return sqrt(normU) + sqrt(normV);
+        }
+
+    private:
+        // (u, v) of one cell, the value type of prolongateAddGather.
+        struct Pair {
+            float u = 0.;
+            float v = 0.;
+
+            inline Pair& operator+=(const Pair &other) {
+                u += other.u;
+                v += other.v;
+                return *this;
+            }
+
+            friend inline Pair operator*(float weight, const Pair &pair) {
+                return Pair{weight * pair.u, weight * pair.v};
+            }
+        };
+
+        std::vector<size_t> shape;
+        std::vector<size_t> originalShape;
+        AlignedVector<float> buffer;
+};
+
+// Element access shared by both layouts, used by the templated kernels.
+template< class T >
+concept FlowLayout = requires(T phi, size_t i) {
+    { phi.u(i, i) } -> std::convertible_to<float>;
+    { phi.v(i, i) } -> std::convertible_to<float>;
+    { phi.rows() } -> std::convertible_to<size_t>;
+    { phi.cols() } -> std::convertible_to<size_t>;
+};
+
+// Type the components of a flow layout are stored in.
+template< FlowLayout Flow >
+using FlowScalar = std::remove_cvref_t<decltype(std::declval<const Flow&>().u(0, 0))>;
+
+inline UV toUV(const UV &phi) {
+    return phi;
+}
+
+inline UV toUV(const InterleavedUV &phi) {
+    UV split(phi.getShape(), 0.0);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 0; j < phi.cols(); j++)
+        for(size_t i = 0; i < phi.rows(); i++) {
+            split.u(i, j) = phi.u(i, j);
+            split.v(i, j) = phi.v(i, j);
+        }
+
+    return split;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// 16-bit storage types for the image derivatives. Values are converted to
+// float on load and all arithmetic stays in float.
+
+// IEEE half precision (10-bit mantissa); converted with F16C where available.
+using Float16 = _Float16;
+
+// bfloat16: the upper half of a float (8-bit mantissa, float exponent range),
+// rounded to nearest even on conversion.
+class BFloat16
+{
+    public:
+        BFloat16() = default;
+
+        BFloat16(float value) {
+            uint32_t word;
+            std::memcpy(&word, &value, sizeof(word));
+            word += 0x7FFF + ((word >> 16) & 1);
+            bits = uint16_t(word >> 16);
+        }
+
+        inline operator float() const {
+            uint32_t word = uint32_t(bits) << 16;
+            float value;
+            std::memcpy(&value, &word, sizeof(value));
+            return value;
+        }
+
+    private:
+        uint16_t bits;
+};
+
+// Storage type of HalfI, chosen at compile time (FLOW_DERIVATIVE_STORAGE).
+#ifdef DERIVATIVES_BF16
+using Half16 = BFloat16;
+#else
+using Half16 = Float16;
+#endif
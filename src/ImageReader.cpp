@@ -0,0 +1,274 @@
+#include "ImageReader.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static size_t little(const unsigned char *p, size_t bytes)
+{
+    size_t value = 0;
+    for(size_t k = 0; k < bytes; k++)
+        value |= size_t(p[k]) << (8 * k);
+    return value;
+}
+
+// Largest width and height accepted; larger headers are rejected before any
+// size arithmetic is done with them.
+static constexpr size_t maxDimension = size_t(1) << 20;
+
+// Checks that lines lines of bits-per-pixel pixels, each line padded to a
+// multiple of align bytes, fit into a file of size bytes after offset, and
+// that the padded float matrix they are read into has a representable size.
+// Every product is overflow-checked. Returns the bytes per line in stride.
+static bool fits(size_t columns, size_t lines, size_t bits, size_t align, size_t offset, size_t size, size_t &stride)
+{
+    if((columns == 0) || (lines == 0) || (columns > maxDimension) || (lines > maxDimension))
+        return false;
+
+    size_t lineBits, bytes, cells, floats;
+    if(__builtin_mul_overflow(columns, bits, &lineBits))
+        return false;
+    stride = (((lineBits + 7) / 8 + align - 1) / align) * align;
+    if(__builtin_mul_overflow(stride, lines, &bytes) || __builtin_add_overflow(bytes, offset, &bytes))
+        return false;
+    if(__builtin_mul_overflow(columns + 2, lines + 2, &cells) || __builtin_mul_overflow(cells, sizeof(float), &floats))
+        return false;
+    return bytes <= size;
+}
+
+// Converts the 8x8 block channel[y][x] to float / 255 and stores its column
+// x at out + x * ld.
+static void storeBlockScalar(const unsigned char channel[8][8], float *out, size_t ld)
+{
+    for(size_t x = 0; x < 8; x++)
+        for(size_t y = 0; y < 8; y++)
+            out[x * ld + y] = channel[y][x] / 255.0f;
+}
+
+__attribute__((target("avx2")))
+static void storeBlockAVX2(const unsigned char channel[8][8], float *out, size_t ld)
+{
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    __m256 r[8];
+    for(size_t y = 0; y < 8; y++) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(channel[y]));
+        r[y] = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), scale);
+    }
+
+    __m256 t[8], s[8];
+    for(size_t k = 0; k < 8; k += 2) {
+        t[k] = _mm256_unpacklo_ps(r[k], r[k + 1]);
+        t[k + 1] = _mm256_unpackhi_ps(r[k], r[k + 1]);
+    }
+    for(size_t k = 0; k < 8; k += 4) {
+        s[k] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        s[k + 1] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        s[k + 2] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        s[k + 3] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for(size_t k = 0; k < 4; k++) {
+        _mm256_storeu_ps(out + k * ld, _mm256_permute2f128_ps(s[k], s[k + 4], 0x20));
+        _mm256_storeu_ps(out + (k + 4) * ld, _mm256_permute2f128_ps(s[k], s[k + 4], 0x31));
+    }
+}
+
+ImageReader::ImageReader(const char *path) :
+    data(nullptr),
+    size(0),
+    format(Format::Invalid),
+    columns(0),
+    lines(0),
+    offset(0),
+    stride(0),
+    bottomUp(false)
+{
+    int file = open(path, O_RDONLY);
+    if(file < 0)
+        return;
+
+    struct stat status;
+    if((fstat(file, &status) == 0) && (status.st_size > 0)) {
+        size = size_t(status.st_size);
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if(mapped != MAP_FAILED)
+            data = static_cast<unsigned char*>(mapped);
+    }
+    close(file);
+
+    if(data == nullptr)
+        return;
+    madvise(data, size, MADV_WILLNEED);
+
+    if(!parseBMP() && !parsePNM())
+        format = Format::Invalid;
+}
+
+ImageReader::~ImageReader()
+{
+    if(data != nullptr)
+        munmap(data, size);
+}
+
+bool ImageReader::parseBMP()
+{
+    if((size < 54) || (data[0] != 'B') || (data[1] != 'M'))
+        return false;
+
+    size_t headerSize = little(data + 14, 4);
+    int64_t width = static_cast<int32_t>(little(data + 18, 4));
+    int64_t height = static_cast<int32_t>(little(data + 22, 4));
+    size_t bpp = little(data + 28, 2);
+    size_t compression = little(data + 30, 4);
+    size_t colours = little(data + 46, 4);
+
+    // RLE is left to CImg; bit fields are read as BGRX like CImg does.
+    if((width <= 0) || (height == 0) || (compression == 1) || (compression == 2))
+        return false;
+
+    switch(bpp) {
+        case 1: format = Format::Palette1; break;
+        case 4: format = Format::Palette4; break;
+        case 8: format = Format::Palette8; break;
+        case 24: format = Format::BGR24; break;
+        case 32: format = Format::BGRX32; break;
+        default: return false;
+    }
+
+    if(bpp < 16) {
+        if(colours == 0)
+            colours = size_t(1) << bpp;
+        size_t table = 14 + headerSize;
+        if((colours > 256) || (table > size) || (4 * colours > size - table))
+            return false;
+        std::fill(palette, palette + 256, 0);
+        for(size_t k = 0; k < colours; k++)
+            palette[k] = data[table + 4 * k + 2];
+    }
+
+    columns = size_t(width);
+    lines = size_t(height < 0 ? -height : height);
+    bottomUp = (height > 0);
+    offset = little(data + 10, 4);
+    return fits(columns, lines, bpp, 4, offset, size, stride);
+}
+
+bool ImageReader::parsePNM()
+{
+    if((size < 3) || (data[0] != 'P') || ((data[1] != '5') && (data[1] != '6')))
+        return false;
+
+    // Width, height and maximum value, separated by whitespace and comments.
+    size_t position = 2;
+    size_t fields[3];
+    for(size_t k = 0; k < 3; k++) {
+        while(position < size && (isspace(data[position]) || data[position] == '#')) {
+            if(data[position] == '#')
+                while(position < size && data[position] != '\n')
+                    position++;
+            else
+                position++;
+        }
+        if(position >= size || !isdigit(data[position]))
+            return false;
+        fields[k] = 0;
+        while(position < size && isdigit(data[position])) {
+            fields[k] = 10 * fields[k] + (data[position++] - '0');
+            if(fields[k] > maxDimension)
+                return false;
+        }
+    }
+    if((position >= size) || !isspace(data[position]) || (fields[2] > 255))
+        return false;
+
+    format = (data[1] == '5') ? Format::Grey8 : Format::RGB24;
+    columns = fields[0];
+    lines = fields[1];
+    bottomUp = false;
+    offset = position + 1;
+    return fits(columns, lines, (format == Format::Grey8) ? 8 : 24, 1, offset, size, stride);
+}
+
+void ImageReader::gather(size_t x0, size_t y, size_t n, unsigned char *channel) const
+{
+    const unsigned char *line = data + offset + stride * (bottomUp ? (lines - 1 - y) : y);
+
+    switch(format) {
+        case Format::Grey8:
+            memcpy(channel, line + x0, n);
+            break;
+        case Format::RGB24:
+            for(size_t x = 0; x < n; x++)
+                channel[x] = line[3 * (x0 + x)];
+            break;
+        case Format::BGR24:
+            for(size_t x = 0; x < n; x++)
+                channel[x] = line[3 * (x0 + x) + 2];
+            break;
+        case Format::BGRX32:
+            for(size_t x = 0; x < n; x++)
+                channel[x] = line[4 * (x0 + x) + 2];
+            break;
+        case Format::Palette1:
+            for(size_t x = 0; x < n; x++)
+                channel[x] = palette[(line[(x0 + x) / 8] >> (7 - ((x0 + x) % 8))) & 1];
+            break;
+        case Format::Palette4:
+            for(size_t x = 0; x < n; x++)
+                channel[x] = palette[(line[(x0 + x) / 2] >> (((x0 + x) % 2) ? 0 : 4)) & 15];
+            break;
+        case Format::Palette8:
+            for(size_t x = 0; x < n; x++)
+                channel[x] = palette[line[x0 + x]];
+            break;
+        case Format::Invalid:
+            break;
+    }
+}
+
+void ImageReader::read(float *out, float ghost) const
+{
+    const size_t ld = lines + 2;
+    const size_t blocks = (columns + 7) / 8;
+    const bool avx2 = __builtin_cpu_supports("avx2");
+
+    #pragma omp parallel for schedule(static)
+    for(size_t block = 0; block < blocks; block++) {
+        const size_t x0 = 8 * block;
+        const size_t n = std::min<size_t>(8, columns - x0);
+
+        if(block == 0)
+            std::fill(out, out + ld, ghost);
+        if(block == blocks - 1)
+            std::fill(out + (columns + 1) * ld, out + (columns + 2) * ld, ghost);
+        for(size_t x = 0; x < n; x++) {
+            out[(x0 + x + 1) * ld] = ghost;
+            out[(x0 + x + 1) * ld + lines + 1] = ghost;
+        }
+
+        unsigned char channel[8][8];
+        float *column = out + (x0 + 1) * ld + 1;
+        size_t y0 = 0;
+        if(n == 8) {
+            for(; y0 + 8 <= lines; y0 += 8) {
+                for(size_t y = 0; y < 8; y++)
+                    gather(x0, y0 + y, 8, channel[y]);
+                if(avx2)
+                    storeBlockAVX2(channel, column + y0, ld);
+                else
+                    storeBlockScalar(channel, column + y0, ld);
+            }
+        }
+        for(; y0 < lines; y0++) {
+            gather(x0, y0, n, channel[0]);
+            for(size_t x = 0; x < n; x++)
+                column[x * ld + y0] = channel[0][x] / 255.0f;
+        }
+    }
+}
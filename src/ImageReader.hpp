@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef IMAGE_READER
+#define IMAGE_READER
+
+#include <cstddef>
+
+// Memory-mapped reader for the uncompressed formats the solver is fed with:
+// BMP (1, 4, 8, 24 and 32 bit, bottom-up or top-down), binary PGM (P5) and
+// binary PPM (P6) with at most 8 bits per sample. Like the CImg path it
+// replaces, it keeps the first channel (red, or grey) of every pixel, so both
+// produce the same values (except for 8-bit BMPs with a palette of fewer than
+// 256 colours, which CImg loads as black); other files are left to CImg.
+class ImageReader
+{
+    public:
+        ImageReader() = delete;
+
+        // Maps and parses path; valid() tells whether it could.
+        explicit ImageReader(const char *path);
+
+        ImageReader(const ImageReader &) = delete;
+        ImageReader& operator=(const ImageReader &) = delete;
+
+        ~ImageReader();
+
+        inline bool valid() const {
+            return format != Format::Invalid;
+        }
+
+        inline size_t width() const {
+            return columns;
+        }
+
+        inline size_t height() const {
+            return lines;
+        }
+
+        // Writes pixel (x, y) / 255 to out[(x + 1) * (height() + 2) + y + 1],
+        // i.e. the interior of a column-major matrix with a ghost layer, and
+        // ghost to that layer. Columns are written in parallel with the
+        // static schedule of the kernels, 8x8 blocks with AVX2 if available.
+        void read(float *out, float ghost) const;
+
+    private:
+        enum class Format { Invalid, Grey8, RGB24, BGR24, BGRX32, Palette1, Palette4, Palette8 };
+
+        bool parseBMP();
+        bool parsePNM();
+
+        // First channel of the pixels x0, ..., x0 + n - 1 of line y.
+        void gather(size_t x0, size_t y, size_t n, unsigned char *channel) const;
+
+        unsigned char *data;
+        size_t size;
+        Format format;
+        size_t columns;
+        size_t lines;
+        size_t offset;
+        size_t stride;
+        bool bottomUp;
+        unsigned char palette[256];
+};
+
+#endif
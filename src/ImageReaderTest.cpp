@@ -0,0 +1,121 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include "Matrix.hpp"
+#include "ImageReader.hpp"
+
+void check(bool condition, const std::string& msg)
+{
+    if (!condition)
+    {
+        std::cout << "FAILED: " << msg << "\n";
+    }
+    else
+    {
+        std::cout << "PASSED: " << msg << "\n";
+    }
+}
+
+static std::string writeFile(const std::string &name, const std::string &contents)
+{
+    std::string path = (std::filesystem::temp_directory_path() / ("flow_reader_" + name)).string();
+    std::ofstream(path, std::ios::binary) << contents;
+    return path;
+}
+
+static std::string little(uint32_t value, size_t bytes)
+{
+    std::string out;
+    for (size_t k = 0; k < bytes; k++)
+        out += char((value >> (8 * k)) & 0xFF);
+    return out;
+}
+
+// 54-byte BMP header followed by payload bytes of pixel data.
+static std::string bmpHeader(int32_t width, int32_t height, uint16_t bpp, uint32_t headerSize, size_t payload)
+{
+    std::string h = "BM" + little(uint32_t(54 + payload), 4) + little(0, 4) + little(54, 4);
+    h += little(headerSize, 4) + little(uint32_t(width), 4) + little(uint32_t(height), 4);
+    h += little(1, 2) + little(bpp, 2) + little(0, 4) + little(uint32_t(payload), 4);
+    h += little(0, 4) + little(0, 4) + little(0, 4) + little(0, 4);
+    return h + std::string(payload, '\x7f');
+}
+
+// Values of the CImg path the reader replaces.
+static bool matchesCImg(const std::string &path)
+{
+    Matrix<float> native(path.c_str());
+    CImg< unsigned char > img(path.c_str());
+    size_t rows = img.height() + 2;
+    size_t cols = img.width() + 2;
+    if (native.rows() != rows || native.cols() != cols)
+        return false;
+
+    for (size_t col = 0; col < cols; col++)
+        for (size_t row = 0; row < rows; row++) {
+            bool ghost = (col == 0) || (row == 0) || (col == cols - 1) || (row == rows - 1);
+            float expected = ghost ? 1.0f : std::clamp((img((col - 1), (row - 1)) / 255.0f), 0.0f, 1.0f);
+            if (native(row, col) != expected)
+                return false;
+        }
+    return true;
+}
+
+void test_cimgParity(std::vector< std::pair< bool, std::string > >& results)
+{
+    for (const auto &entry : std::filesystem::directory_iterator(FLOW_TEST_IMAGES)) {
+        if (entry.path().extension() != ".bmp")
+            continue;
+        std::string path = entry.path().string();
+        results.push_back({ImageReader(path.c_str()).valid(), "test_cimgParity: native reader accepts " + path});
+        results.push_back({matchesCImg(path), "test_cimgParity: same values as CImg for " + path});
+    }
+
+    std::string odd = writeFile("odd.ppm", "P6\n# comment\n11 3\n255\n" + std::string(11 * 3 * 3, '\x40'));
+    results.push_back({matchesCImg(odd), "test_cimgParity: same values as CImg for an 11x3 PPM"});
+    std::string grey = writeFile("grey.pgm", "P5\n9 10\n255\n" + std::string(90, '\xc8'));
+    results.push_back({matchesCImg(grey), "test_cimgParity: same values as CImg for a 9x10 PGM"});
+}
+
+void test_rejectsMalformed(std::vector< std::pair< bool, std::string > >& results)
+{
+    const std::vector< std::pair< std::string, std::string > > files = {
+        {"overflow.ppm", "P6\n6148914691236517206 1\n255\n" + std::string(8, '\0')},
+        {"overflow_height.pgm", "P5\n1 18446744073709551615\n255\n" + std::string(8, '\0')},
+        {"large.pgm", "P5\n1048577 1\n255\n" + std::string(8, '\0')},
+        {"truncated.ppm", "P6\n4 4\n255\n" + std::string(10, '\0')},
+        {"no_data.pgm", "P5\n2 2\n255"},
+        {"zero.pgm", "P5\n0 4\n255\n" + std::string(8, '\0')},
+        {"wide.bmp", bmpHeader(0x7fffffff, 1, 24, 40, 16)},
+        {"tall.bmp", bmpHeader(1, int32_t(0x80000000u), 24, 40, 16)},
+        {"truncated.bmp", bmpHeader(16, 16, 24, 40, 100)},
+        {"palette.bmp", bmpHeader(4, 4, 8, 0xfffffff0u, 16)},
+        {"short.bmp", "BM" + std::string(20, '\0')},
+    };
+
+    for (const auto &[name, contents] : files)
+        results.push_back({!ImageReader(writeFile(name, contents).c_str()).valid(),
+                           "test_rejectsMalformed: " + name + " is rejected"});
+}
+
+int main()
+{
+    std::vector< std::pair< bool, std::string > > results;
+
+    test_cimgParity(results);
+    test_rejectsMalformed(results);
+
+    size_t passed = 0;
+    for (auto [condition, msg] : results)
+    {
+        check(condition, msg);
+        if (condition)
+        {
+            passed++;
+        }
+    }
+
+    std::cout << "--- " << passed << "/" << results.size() << " checks passed ---" << std::endl;
+
+    return passed != results.size();
+}
@@ -3,6 +3,12 @@
 #include <omp.h>
 #include <vector>
 #include "Matrix.hpp"
+#include "Half.hpp"
+
+// How the coarse levels of an IStorage are obtained: by restricting the
+// derivatives of the finer level, or by restricting the two frames and
+// taking the derivatives of the restricted frames.
+enum class Pyramid { Derivatives, Images };
 
 class I
 {
@@ -16,78 +22,372 @@ class I
         I(const Matrix<float> &x, const Matrix<float> &y, const Matrix<float> &t) :
             x(x), y(y), t(t) {}
 
-        I(const Matrix<float> &&x, const Matrix<float> &&y, const Matrix<float> &&t) :
+        I(Matrix<float> &&x, Matrix<float> &&y, Matrix<float> &&t) :
             x(std::move(x)),
             y(std::move(y)),
             t(std::move(t))
             { }
 
-        I(const Matrix<float> &a, const Matrix<float> &b) :
-            x(Matrix<float>(a.rows(), a.cols(), 0.0)),
-            y(Matrix<float>(a.rows(), a.cols(), 0.0)),
-            t(Matrix<float>(a.rows(), a.cols(), 0.0))
+        // Ix, Iy and It from one pass over both frames: every 2x2 block of a
+        // and b is read once and the three derivatives are written together.
+        // The last row and column have no block and are set to zero. Ix and Iy
+        // are divided by the grid spacing h, measured in finest-level pixels.
+        I(const Matrix<float> &a, const Matrix<float> &b, float h = 1.0f) :
+            x(Matrix<float>(a.rows(), a.cols(), uninitialized)),
+            y(Matrix<float>(a.rows(), a.cols(), uninitialized)),
+            t(Matrix<float>(a.rows(), a.cols(), uninitialized))
         {
-            float left, right;
-            #pragma omp parallel for schedule(static) private(left, right)
-            for(size_t y = 0; y < (a.cols() - 1); y++)
-                for (size_t x = 0; x < (a.rows() - 1); x++)
-                {
-                    left =   a(x      , (y + 1))
-                        - a(x      ,  y     )
-                        + a((x + 1), (y + 1))
-                        - a((x + 1),  y     );
-
-                    right =  b(x      , (y + 1))
-                        - b(x      ,  y     )
-                        + b((x + 1), (y + 1))
-                        - b((x + 1),  y     );
-                    
-                    this->x(x, y) = 0.25 * (left + right);
+            const size_t rows = a.rows();
+            const size_t cols = a.cols();
+            const float scale = 0.25f / h;
+
+            #pragma omp parallel for schedule(static)
+            for(size_t col = 0; col < cols; col++) {
+                float *ix = this->x.data() + rows * col;
+                float *iy = this->y.data() + rows * col;
+                float *it = this->t.data() + rows * col;
+
+                if(col == cols - 1) {
+                    for(size_t row = 0; row < rows; row++)
+                        ix[row] = iy[row] = it[row] = 0.0f;
+                    continue;
                 }
 
+                const float *a0 = a.data() + rows * col;
+                const float *a1 = a0 + rows;
+                const float *b0 = b.data() + rows * col;
+                const float *b1 = b0 + rows;
 
-            #pragma omp parallel for schedule(static) private(left, right)
-            for(size_t y = 0; y < (a.cols() - 1); y++)
-                for (size_t x = 0; x < (a.rows() - 1); x++)
-                {
-                    left =   a((x + 1),  y     )
-                        - a(x      ,  y     )
-                        + a((x + 1), (y + 1))
-                        - a(x      , (y + 1));
-
-                    right =  b((x + 1),  y     )
-                        - b(x      ,  y     )
-                        + b((x + 1), (y + 1))
-                        - b(x      , (y + 1));
-                    
-                    this->y(x, y) = 0.25 * (left + right);
+                #pragma omp simd
+                for(size_t row = 0; row < rows - 1; row++) {
+                    float leftX  = a1[row] - a0[row] + a1[row + 1] - a0[row + 1];
+                    float rightX = b1[row] - b0[row] + b1[row + 1] - b0[row + 1];
+                    float leftY  = a0[row + 1] - a0[row] + a1[row + 1] - a1[row];
+                    float rightY = b0[row + 1] - b0[row] + b1[row + 1] - b1[row];
+                    float leftT  = a0[row] + a1[row] + a0[row + 1] + a1[row + 1];
+                    float rightT = b0[row] + b1[row] + b0[row + 1] + b1[row + 1];
+
+                    ix[row] = scale * (leftX + rightX);
+                    iy[row] = scale * (leftY + rightY);
+                    it[row] = 0.25f * (-leftT + rightT);
                 }
+                ix[rows - 1] = iy[rows - 1] = it[rows - 1] = 0.0f;
+            }
+        }
+
+        // Coefficients of the Horn-Schunck point system at (i, j).
+        inline float diagU(float alpha, size_t i, size_t j) const {
+            return (x(i, j) * x(i, j)) + (4.0 * alpha);
+        }
+
+        inline float diagV(float alpha, size_t i, size_t j) const {
+            return (y(i, j) * y(i, j)) + (4.0 * alpha);
+        }
+
+        inline float cross(size_t i, size_t j) const {
+            return x(i, j) * y(i, j);
+        }
+
+        inline float invDiagU(float alpha, size_t i, size_t j) const {
+            return 1.0 / diagU(alpha, i, j);
+        }
+
+        inline float invDiagV(float alpha, size_t i, size_t j) const {
+            return 1.0 / diagV(alpha, i, j);
+        }
+
+        // 1 / determinant of the 2x2 point system [diagU cross; cross diagV].
+        // diagU * diagV - cross^2 is expanded to 4 alpha (Ix^2 + Iy^2) + 16 alpha^2,
+        // a sum of non-negative terms, so the Ix^2 Iy^2 products do not cancel.
+        inline float invDet(float alpha, size_t i, size_t j) const {
+            return 1.0 / ((4.0 * alpha) * ((x(i, j) * x(i, j)) + (y(i, j) * y(i, j))) + (16.0 * alpha * alpha));
+        }
 
-            #pragma omp parallel for schedule(static) private(left, right)
-            for(size_t y = 0; y < (a.cols() - 1); y++)
-                for (size_t x = 0; x < (a.rows() - 1); x++)
-                {
-                    left =   a(x      ,  y     )
-                        + a(x      , (y + 1))
-                        + a((x + 1),  y     )
-                        + a((x + 1), (y + 1));
-
-                    right =  b(x      ,  y     )
-                        + b(x      , (y + 1))
-                        + b((x + 1),  y     )
-                        + b((x + 1), (y + 1));
-                    
-                    this->t(x, y) = 0.25 * (-left + right);
+        inline I restrict() const {
+            return I(x.restrict(), y.restrict(), t.restrict());
+        }
+
+};
+
+// Point-system coefficients of one level for a fixed alpha. The coefficients
+// that need a division - 1 / diagU, 1 / diagV and 1 / det - are stored;
+// diagU, diagV and cross are formed from the derivatives of the level, so the
+// coupled smoother reads three fields per cell (Ix, Iy, 1 / det) instead of
+// six. The derivatives are referenced, not copied: I must outlive this
+// object and stay in place, as it does in IStorage. The accessors take alpha
+// only to match the other layouts; HornSchunckOperator asserts that it is
+// the weight() the coefficients were built for.
+class Coefficients
+{
+    public:
+        Coefficients() = delete;
+
+        Coefficients(const I &I, float alpha) :
+            ix(I.x.data()),
+            iy(I.y.data()),
+            ld(I.x.rows()),
+            alpha(alpha),
+            fourAlpha(4.0f * alpha),
+            invU(I.x.rows(), I.x.cols(), uninitialized),
+            invV(I.x.rows(), I.x.cols(), uninitialized),
+            idet(I.x.rows(), I.x.cols(), uninitialized)
+        {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < idet.cols(); j++)
+                for(size_t i = 0; i < idet.rows(); i++) {
+                    invU(i, j) = 1.0f / diagU(alpha, i, j);
+                    invV(i, j) = 1.0f / diagV(alpha, i, j);
+                    idet(i, j) = I.invDet(alpha, i, j);
                 }
         }
 
-        //TODO avoid copy!
-        inline I restrict() {
-            return I(   std::move(this->x.restrict()),
-                        std::move(this->y.restrict()),
-                        std::move(this->t.restrict())   );
+        [[nodiscard]] inline size_t rows() const {
+            return idet.rows();
+        }
+
+        [[nodiscard]] inline size_t cols() const {
+            return idet.cols();
+        }
+
+        [[nodiscard]] inline float weight() const {
+            return alpha;
+        }
+
+        inline float diagU(float, size_t i, size_t j) const {
+            float x = ix[ld * j + i];
+            return x * x + fourAlpha;
+        }
+
+        inline float diagV(float, size_t i, size_t j) const {
+            float y = iy[ld * j + i];
+            return y * y + fourAlpha;
+        }
+
+        inline float cross(size_t i, size_t j) const {
+            return ix[ld * j + i] * iy[ld * j + i];
         }
 
+        inline float invDiagU(float, size_t i, size_t j) const {
+            return invU(i, j);
+        }
+
+        inline float invDiagV(float, size_t i, size_t j) const {
+            return invV(i, j);
+        }
+
+        inline float invDet(float, size_t i, size_t j) const {
+            return idet(i, j);
+        }
+
+    private:
+        const float *ix, *iy;
+        size_t ld;
+        float alpha;
+        float fourAlpha;
+        Matrix<float> invU, invV;
+        Matrix<float> idet;
+};
+
+// Interleaved counterpart of Coefficients: the six coefficients of a cell
+// are stored next to each other, so a sweep reads one stream. As there, the
+// accessors ignore alpha in favour of weight().
+class PackedI
+{
+    public:
+        struct Cell {
+            float diagU, diagV, cross, invDiagU, invDiagV, invDet;
+        };
+
+        PackedI() = delete;
+
+        PackedI(const I &I, float alpha) :
+            shape(I.x.getShape()),
+            alpha(alpha),
+            cells(AlignedVector<Cell>(shape[0] * shape[1]))
+        {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < shape[1]; j++)
+                for(size_t i = 0; i < shape[0]; i++) {
+                    cells[shape[0] * j + i] = { I.diagU(alpha, i, j), I.diagV(alpha, i, j), I.cross(i, j),
+                                                I.invDiagU(alpha, i, j), I.invDiagV(alpha, i, j), I.invDet(alpha, i, j) };
+                }
+        }
+
+        [[nodiscard]] inline size_t rows() const {
+            return shape[0];
+        }
+
+        [[nodiscard]] inline size_t cols() const {
+            return shape[1];
+        }
+
+        [[nodiscard]] inline float weight() const {
+            return alpha;
+        }
+
+        inline float diagU(float, size_t i, size_t j) const {
+            return cells[shape[0] * j + i].diagU;
+        }
+
+        inline float diagV(float, size_t i, size_t j) const {
+            return cells[shape[0] * j + i].diagV;
+        }
+
+        inline float cross(size_t i, size_t j) const {
+            return cells[shape[0] * j + i].cross;
+        }
+
+        inline float invDiagU(float, size_t i, size_t j) const {
+            return cells[shape[0] * j + i].invDiagU;
+        }
+
+        inline float invDiagV(float, size_t i, size_t j) const {
+            return cells[shape[0] * j + i].invDiagV;
+        }
+
+        inline float invDet(float, size_t i, size_t j) const {
+            return cells[shape[0] * j + i].invDet;
+        }
+
+    private:
+        std::vector<size_t> shape;
+        float alpha;
+        AlignedVector<Cell> cells;
+};
+
+// Image derivatives of one level stored in 16 bits: Ix and Iy of a cell lie
+// next to each other and the coefficients are recomputed in float on every
+// access, so a sweep reads 4 bytes per cell instead of the 12 of
+// Coefficients or the 24 of PackedI. It - only needed for the right-hand side - is not kept.
+template< class Half >
+class HalfI
+{
+    public:
+        HalfI() = delete;
+
+        explicit HalfI(const I &I) :
+            shape(I.x.getShape()),
+            cells(AlignedVector<Half>(2 * shape[0] * shape[1]))
+        {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < shape[1]; j++)
+                for(size_t i = 0; i < shape[0]; i++) {
+                    cells[2 * (shape[0] * j + i)] = Half(I.x(i, j));
+                    cells[2 * (shape[0] * j + i) + 1] = Half(I.y(i, j));
+                }
+        }
+
+        [[nodiscard]] inline size_t rows() const {
+            return shape[0];
+        }
+
+        [[nodiscard]] inline size_t cols() const {
+            return shape[1];
+        }
+
+        inline float x(size_t i, size_t j) const {
+            return float(cells[2 * (shape[0] * j + i)]);
+        }
+
+        inline float y(size_t i, size_t j) const {
+            return float(cells[2 * (shape[0] * j + i) + 1]);
+        }
+
+        inline float diagU(float alpha, size_t i, size_t j) const {
+            float xij = x(i, j);
+            return xij * xij + 4.0f * alpha;
+        }
+
+        inline float diagV(float alpha, size_t i, size_t j) const {
+            float yij = y(i, j);
+            return yij * yij + 4.0f * alpha;
+        }
+
+        inline float cross(size_t i, size_t j) const {
+            return x(i, j) * y(i, j);
+        }
+
+        inline float invDiagU(float alpha, size_t i, size_t j) const {
+            return 1.0f / diagU(alpha, i, j);
+        }
+
+        inline float invDiagV(float alpha, size_t i, size_t j) const {
+            return 1.0f / diagV(alpha, i, j);
+        }
+
+        // Cancellation-free form of 1 / (diagU * diagV - cross^2), see I::invDet.
+        inline float invDet(float alpha, size_t i, size_t j) const {
+            float xij = x(i, j), yij = y(i, j);
+            return 1.0f / ((4.0f * alpha) * (xij * xij + yij * yij) + 16.0f * alpha * alpha);
+        }
+
+    private:
+        std::vector<size_t> shape;
+        AlignedVector<Half> cells;
+};
+
+// Coefficient access shared by I, Coefficients, PackedI and HalfI, used by
+// the templated kernels.
+template< class T >
+concept CoefficientLayout = requires(T c, float alpha, size_t i) {
+    { c.diagU(alpha, i, i) } -> std::convertible_to<float>;
+    { c.diagV(alpha, i, i) } -> std::convertible_to<float>;
+    { c.cross(i, i) } -> std::convertible_to<float>;
+    { c.invDiagU(alpha, i, i) } -> std::convertible_to<float>;
+    { c.invDiagV(alpha, i, i) } -> std::convertible_to<float>;
+    { c.invDet(alpha, i, i) } -> std::convertible_to<float>;
+};
+
+// A frame and, for Pyramid::Images, its full-weighting restrictions down to
+// the coarsest level of an IStorage. A frame shared by two consecutive pairs
+// of a sequence is then loaded and restricted only once.
+class FramePyramid
+{
+    public:
+        FramePyramid() = delete;
+
+        FramePyramid(Matrix<float> &&frame, Pyramid pyramid) :
+            frames(std::vector<Matrix<float>>())
+        {
+            size_t levels = (pyramid == Pyramid::Images) ? levelShapes(frame.getShape()).size() : 1;
+            frames.reserve(levels);
+            frames.push_back(std::move(frame));
+            while(frames.size() < levels) {
+                Matrix<float> coarse = restrictFrame(frames.back());
+                frames.push_back(std::move(coarse));
+            }
+        }
+
+        inline const Matrix<float>&
+        operator()(size_t level) const {
+            return frames[level];
+        }
+
+        inline size_t levels() const {
+            return frames.size();
+        }
+
+        // Shapes of the levels: restricted while the grid is at least 5x5.
+        static std::vector<std::vector<size_t>> levelShapes(std::vector<size_t> shape) {
+            std::vector<std::vector<size_t>> shapes = {shape};
+            while((shape[0] >= 5) && (shape[1] >= 5)) {
+                shape = {((shape[0] - 2) / 2) + 2, ((shape[1] - 2) / 2) + 2};
+                shapes.push_back(shape);
+            }
+            return shapes;
+        }
+
+    private:
+        // Full-weighting restriction of a frame; the ghost layer keeps the
+        // value of the finer frame's ghost layer.
+        static Matrix<float> restrictFrame(const Matrix<float> &frame) {
+            Matrix<float> coarse(((frame.rows() - 2) / 2) + 2, ((frame.cols() - 2) / 2) + 2,
+                                 frame(0, 0), frame.getShape());
+            frame.restrictInto(coarse);
+            return coarse;
+        }
+
+        std::vector<Matrix<float>> frames;
 };
 
 class IStorage
@@ -98,18 +398,43 @@ class IStorage
         IStorage(const std::vector<I> &i) :
             is(i) {}
 
-        IStorage(const std::vector<I> &&i) :
+        IStorage(std::vector<I> &&i) :
             is(std::move(i)) {}
 
-        IStorage(const Matrix<float> &a, const Matrix<float> &b) :
+        // The coefficient layouts point into the derivatives, so the levels
+        // are only handed out read-only and an IStorage is moved, never copied.
+        IStorage(const IStorage &) = delete;
+        IStorage& operator=(const IStorage &) = delete;
+        IStorage(IStorage &&) = default;
+        IStorage& operator=(IStorage &&) = default;
+
+        // Takes the frames over; callers that keep them pass copies explicitly.
+        IStorage(Matrix<float> &&a, Matrix<float> &&b, Pyramid pyramid = Pyramid::Derivatives) :
+            IStorage(FramePyramid(std::move(a), pyramid), FramePyramid(std::move(b), pyramid), pyramid)
+            { }
+
+        // All levels are carved from one arena and moved into place. With
+        // Pyramid::Images both frame pyramids must reach the coarsest level.
+        IStorage(const FramePyramid &a, const FramePyramid &b, Pyramid pyramid) :
             is(std::vector<I>())
         {
-            I current(a, b);
-            is.push_back(current);
+            std::vector<std::vector<size_t>> shapes = FramePyramid::levelShapes(a(0).getShape());
+            size_t bytes = 0;
+            for(const std::vector<size_t> &shape : shapes)
+                bytes += 3 * BufferArena::footprint(shape[0] * shape[1] * sizeof(float));
+
+            is.reserve(shapes.size());
+            BufferArena arena(bytes);
+            BufferArena::Scope scope(arena);
 
-            while((current.x.cols() >= 5) && (current.x.rows() >= 5)) {
-                current = std::move(current.restrict());
-                is.push_back(current);
+            is.push_back(I(a(0), b(0)));
+            for(size_t level = 1; level < shapes.size(); level++) {
+                if(pyramid == Pyramid::Derivatives) {
+                    I coarse = is.back().restrict();
+                    is.push_back(std::move(coarse));
+                }
+                else
+                    is.push_back(I(a(level), b(level), float(size_t(1) << level)));
             }
         }
 
@@ -118,12 +443,50 @@ class IStorage
             return is[index];
         }
 
-        inline I&
-        operator()(size_t index) {
-            return is[index];
+        inline size_t levels() const {
+            return is.size();
+        }
+
+        // Precomputes the point-system coefficients of every level for alpha.
+        inline void precompute(float alpha) {
+            precomputed.clear();
+            for(const I &level : is)
+                precomputed.push_back(Coefficients(level, alpha));
+        }
+
+        inline const Coefficients&
+        coefficients(size_t index) const {
+            return precomputed[index];
+        }
+
+        // Builds the interleaved coefficients of every level for alpha.
+        inline void pack(float alpha) {
+            packedLevels.clear();
+            for(const I &level : is)
+                packedLevels.push_back(PackedI(level, alpha));
+        }
+
+        inline const PackedI&
+        packed(size_t index) const {
+            return packedLevels[index];
+        }
+
+        // Stores the derivatives of every level in 16 bits (see HalfI).
+        inline void compress() {
+            compressedLevels.clear();
+            for(const I &level : is)
+                compressedLevels.push_back(HalfI<Half16>(level));
+        }
+
+        inline const HalfI<Half16>&
+        compressed(size_t index) const {
+            return compressedLevels[index];
         }
 
     private:
         std::vector<I> is;
+        std::vector<Coefficients> precomputed;
+        std::vector<PackedI> packedLevels;
+        std::vector<HalfI<Half16>> compressedLevels;
 
 };
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+
+// Storage layout of the multigrid hierarchy, chosen at compile time. The
+// default keeps u, v, the derivatives and 1 / det in separate matrices;
+// INTERLEAVED_LAYOUT stores (u, v) pairs and packs the coefficients per cell.
+// DERIVATIVES_FP16 / DERIVATIVES_BF16 replace the precomputed coefficients by
+// 16-bit derivatives (HalfI) in either flow layout.
+#ifdef INTERLEAVED_LAYOUT
+using Flow = InterleavedUV;
+#else
+using Flow = UV;
+#endif
+
+#if defined(DERIVATIVES_FP16) || defined(DERIVATIVES_BF16)
+inline void prepareCoefficients(IStorage &II, float)
+{
+    II.compress();
+}
+
+inline const HalfI<Half16>& levelCoefficients(const IStorage &II, size_t level)
+{
+    return II.compressed(level);
+}
+#elif defined(INTERLEAVED_LAYOUT)
+inline void prepareCoefficients(IStorage &II, float alpha)
+{
+    II.pack(alpha);
+}
+
+inline const PackedI& levelCoefficients(const IStorage &II, size_t level)
+{
+    return II.packed(level);
+}
+#else
+inline void prepareCoefficients(IStorage &II, float alpha)
+{
+    II.precompute(alpha);
+}
+
+inline const Coefficients& levelCoefficients(const IStorage &II, size_t level)
+{
+    return II.coefficients(level);
+}
+#endif
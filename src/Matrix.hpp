@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <stdexcept>
 #include <vector>
+#include <algorithm>
 #include <cassert>
 #include <utility>
 #include <omp.h>
@@ -16,12 +17,71 @@
 #define cimg_display 0
 
 #include "CImg.h"
+#include "Buffer.hpp"
+#include "ImageReader.hpp"
 
 using namespace cimg_library;
 
 template< class T >
 concept Arithmetic = std::is_arithmetic_v< T >;
 
+// Adds the bilinear prolongation of a coarse grid (coarseRows x coarseCols,
+// ghost layer included) to a fine grid; shared by Matrix and InterleavedUV.
+// coarse(i, j) returns a coarse value, add(i, j, value) adds value to fine
+// cell (i, j). Value is a component or a (u, v) pair and must support +=
+// and multiplication by a Weight. Every fine cell gathers its (at most four)
+// coarse contributions with the weights 1, 1/2 and 1/4, so fine columns are
+// split between threads without write conflicts and without a temporary. The
+// contributions are summed in the order the single-threaded scatter of the
+// original prolongate() added them (coarse columns, then coarse rows,
+// ascending) and only then added to the fine cell, so the result is
+// bit-identical to that prolongate() followed by += (checked by matrix_test).
+template< class Value, class Weight, class Coarse, class Add >
+inline void prolongateAddGather(size_t coarseRows, size_t coarseCols, Coarse coarse, Add add)
+{
+    const size_t lastRow = coarseRows - 2;
+    const size_t lastCol = coarseCols - 2;
+
+    #pragma omp parallel for schedule(static)
+    for (size_t col = 1; col <= (2 * lastCol + 1); col += 1) {
+        // coarse columns contributing to this fine column, left one first;
+        // a missing neighbour gets weight 0 and adds nothing
+        size_t first = col / 2;
+        size_t second = (col + 1) / 2;
+        const Weight wFirst = (col % 2 == 0) ? 1.0 : ((first >= 1) ? 0.5 : 0.0);
+        const Weight wSecond = (col % 2 == 0) ? 0.0 : ((second <= lastCol) ? 0.5 : 0.0);
+        first = std::clamp< size_t >(first, 1, lastCol);
+        second = std::clamp< size_t >(second, 1, lastCol);
+        const Weight hFirst = 0.5 * wFirst;
+        const Weight hSecond = 0.5 * wSecond;
+
+        Value upperFirst = Value(), upperSecond = Value();
+        for (size_t row = 1; row <= lastRow; row += 1) {
+            Value lowerFirst = coarse(row, first);
+            Value lowerSecond = coarse(row, second);
+
+            Value between = Value();
+            between += hFirst * upperFirst;
+            between += hFirst * lowerFirst;
+            between += hSecond * upperSecond;
+            between += hSecond * lowerSecond;
+            add(row * 2 - 1, col, between);
+
+            Value on = Value();
+            on += wFirst * lowerFirst;
+            on += wSecond * lowerSecond;
+            add(row * 2, col, on);
+
+            upperFirst = lowerFirst;
+            upperSecond = lowerSecond;
+        }
+        Value below = Value();
+        below += hFirst * upperFirst;
+        below += hSecond * upperSecond;
+        add(lastRow * 2 + 1, col, below);
+    }
+}
+
 template< Arithmetic ComponentType >    
 class Matrix
 {
@@ -30,12 +90,16 @@ public:
     Matrix() = delete;
 
     // Constructor for matrix of certain size.
-    explicit Matrix(size_t rows, size_t cols) : shape({rows, cols}), originalShape({rows, cols}),
-        buffer(std::vector<ComponentType>(rows * cols, 0.0)) { };
+    explicit Matrix(size_t rows, size_t cols) : Matrix(rows, cols, 0.0) { };
+
+    // Constructor for matrix of certain size whose entries are all written
+    // by the caller; the buffer is neither zeroed nor touched.
+    Matrix(size_t rows, size_t cols, Uninitialized) : shape({rows, cols}),
+        buffer(AlignedVector<ComponentType>(rows * cols)), originalShape({rows, cols}) { }
 
     // Constructor for matrix of certain size with constant fill-value.
     Matrix(size_t rows, size_t cols, const ComponentType& fillValue) : shape({rows, cols}), 
-        buffer(std::vector<ComponentType>(rows * cols)), originalShape({rows, cols})  {
+        buffer(AlignedVector<ComponentType>(rows * cols)), originalShape({rows, cols})  {
         #pragma omp parallel for schedule(static)
         for(size_t j = 0; j < shape[1]; j++) {
             for(size_t i = 0; i < shape[0]; i++) {
@@ -46,7 +110,7 @@ public:
 
     // Constructor for matrix of certain size with constant fill-value.
     Matrix(size_t rows, size_t cols, const ComponentType& fillValue, const std::vector<size_t> &restrictFrom) : shape({rows, cols}), 
-        buffer(std::vector<ComponentType>(rows * cols)), originalShape(restrictFrom)  {
+        buffer(AlignedVector<ComponentType>(rows * cols)), originalShape(restrictFrom)  {
         #pragma omp parallel for schedule(static)
         for(size_t j = 0; j < shape[1]; j++) {
             for(size_t i = 0; i < shape[0]; i++) {
@@ -57,13 +121,7 @@ public:
 
     // Constructing matrix from file.
     Matrix(const char *path) {
-        if (FILE *file = fopen(path, "r")) {
-            fclose(file);
-            readFromImage(path);
-        } else {
-            std::cerr << "The file \"" << path << "\" does not exist!\n";
-            exit(-1);
-        }
+        readFromImage(path);
     }
 
     // Copy-constructor.
@@ -71,7 +129,7 @@ public:
         //std::cout << "Copy-constructor" << std::endl;
         this->shape = other.shape;
         this->originalShape = other.originalShape;
-        this->buffer = std::vector<ComponentType>(this->shape[0] * this->shape[1]);
+        this->buffer = AlignedVector<ComponentType>(this->shape[0] * this->shape[1]);
         #pragma omp parallel for schedule(static)
         for(size_t j = 0; j < shape[1]; j++) {
             for(size_t i = 0; i < shape[0]; i++) {
@@ -101,6 +159,8 @@ public:
         //std::cout << "Copy-assignment" << std::endl;
         this->shape = other.shape;
         this->originalShape = other.originalShape;
+        if(buffer.size() != other.buffer.size())
+            buffer = AlignedVector<ComponentType>(other.buffer.size());
         #pragma omp parallel for schedule(static)
         for(size_t j = 0; j < shape[1]; j++) {
             for(size_t i = 0; i < shape[0]; i++) {
@@ -154,6 +214,15 @@ public:
          return buffer[shape[0] * col + row];
     }
 
+    // Raw column-major storage, ghost layer included.
+    inline ComponentType* data() {
+        return buffer.data();
+    }
+
+    inline const ComponentType* data() const {
+        return buffer.data();
+    }
+
     inline void checkIndex(size_t row, size_t col){
         if(row >= shape[0] || col >= shape[1])
             std::cout << "wrong index!\n";
@@ -252,14 +321,14 @@ public:
         return lhs; // return the result by value (uses move constructor)
     }
 
-    inline ComponentType norm(bool l2) {
+    inline ComponentType norm(bool l2) const {
         if(l2)
             return l2Norm();
         else
             return linfNorm();
     }
 
-    inline ComponentType l2Norm() {
+    inline ComponentType l2Norm() const {
         ComponentType norm = 0.;
 
         #pragma omp parallel for schedule(static) reduction(+:norm)
@@ -270,7 +339,7 @@ public:
         return sqrt(norm);
     }
 
-    inline ComponentType linfNorm() {
+    inline ComponentType linfNorm() const {
         ComponentType norm = 0.;
 
         #pragma omp parallel for schedule(static) reduction(max:norm)
@@ -282,42 +351,59 @@ public:
         return norm;
     }
 
-    // Prolongate function
-    Matrix prolongate() {
-        Matrix prolongated(originalShape[0], originalShape[1], 0.);
-
+    // Sets every entry, ghost layer included, to fillValue.
+    void fill(const ComponentType& fillValue) {
         #pragma omp parallel for schedule(static)
-        for (size_t mat_col = 1; mat_col < cols() - 1; mat_col += 1) {
-            for (size_t mat_row = 1; mat_row < rows() - 1; mat_row += 1) {
-                prolongated.get(mat_row * 2, mat_col * 2) += get(mat_row, mat_col);
-                prolongated.get(mat_row * 2 + 1, mat_col * 2 + 1) += 0.25 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2 + 1, mat_col * 2 - 1) += 0.25 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2 - 1, mat_col * 2 - 1) += 0.25 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2 - 1, mat_col * 2 + 1) += 0.25 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2, mat_col * 2 - 1) += 0.5 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2, mat_col * 2 + 1) += 0.5 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2 - 1, mat_col * 2) += 0.5 * get(mat_row, mat_col);
-                prolongated.get(mat_row * 2 + 1, mat_col * 2) += 0.5 * get(mat_row, mat_col);
+        for(size_t j = 0; j < shape[1]; j++) {
+            for(size_t i = 0; i < shape[0]; i++) {
+                buffer[(shape[0] * j) + i] = fillValue;
             }
         }
+    }
+
+    // Prolongate function
+    Matrix prolongate() const {
+        Matrix prolongated(originalShape[0], originalShape[1], 0.);
+        prolongated.prolongateAdd(*this);
 
         // return the result by reference
         return prolongated;
     }
 
-    inline const ComponentType computeWeightedSum(size_t row, size_t col) {
+    // Adds the bilinear prolongation of coarse to *this, see prolongateAddGather.
+    void prolongateAdd(const Matrix &coarse) {
+
+        assert((2 * (coarse.rows() - 2) + 1) < rows());
+        assert((2 * (coarse.cols() - 2) + 1) < cols());
+
+        prolongateAddGather< ComponentType, ComponentType >(coarse.rows(), coarse.cols(),
+            [&](size_t i, size_t j) { return coarse.get(i, j); },
+            [&](size_t i, size_t j, ComponentType value) { get(i, j) += value; });
+    }
+
+    inline const ComponentType computeWeightedSum(size_t row, size_t col) const {
         ComponentType edges = get(row, col-1) + get(row, col+1) + get(row-1, col) + get(row+1, col);
         ComponentType corners = get(row-1, col-1) + get(row-1, col+1) + get(row+1, col-1) + get(row+1, col+1);
         return get(row, col) / 4 + edges / 8 + corners / 16;
     }
 
     // Restrict function
-    Matrix restrict() {
+    Matrix restrict() const {
 
         size_t rows2H = ((rows() - 2) / 2) + 2;
         size_t cols2H = ((cols() - 2) / 2) + 2;
 
         Matrix restricted(rows2H, cols2H, 0., shape);
+        restrictInto(restricted);
+
+        return restricted;
+    }
+
+    // Restricts *this into the interior of an already allocated coarse matrix.
+    void restrictInto(Matrix &restricted) const {
+
+        assert(restricted.rows() == ((rows() - 2) / 2) + 2);
+        assert(restricted.cols() == ((cols() - 2) / 2) + 2);
 
         #pragma omp parallel for schedule(static)
         for (size_t mat_col = 1; mat_col < restricted.cols() - 1; mat_col += 1) {
@@ -325,24 +411,45 @@ public:
                 restricted.get(mat_row, mat_col) = computeWeightedSum(mat_row * 2, mat_col * 2);
             }
         }
-
-        return restricted;
     }
 
     //CImg IO
     void readFromImage(const char *path)
     {
+        if constexpr (std::is_same_v<ComponentType, float>) {
+            ImageReader reader(path);
+            if (reader.valid()) {
+                shape = std::vector({reader.height() + 2, reader.width() + 2});
+                originalShape = shape;
+                buffer = AlignedVector<ComponentType>(shape[0] * shape[1]);
+                reader.read(buffer.data(), 1.0f);
+                return;
+            }
+        }
+
+        if (FILE *file = fopen(path, "r")) {
+            fclose(file);
+        } else {
+            std::cerr << "The file \"" << path << "\" does not exist!\n";
+            exit(-1);
+        }
+
         CImg< unsigned char > img(path);
 
         size_t cols = img.width() + 2;
         size_t rows = img.height() + 2;
         shape = std::vector({rows, cols});
 
-        buffer = std::vector<ComponentType>(cols * rows, 1.0);
+        originalShape = shape;
+        buffer = AlignedVector<ComponentType>(cols * rows);
 
-        for (size_t col = 1; col < (shape[1] - 1); col += 1) {
-            for(size_t row = 1; row < (shape[0] - 1); row += 1) {
-                buffer[(shape[0] * col) + row] = std::clamp((img((col - 1), (row - 1)) / 255.0f), 0.0f, 1.0f);
+        // Same static column schedule as the kernels, so every page is first
+        // touched by the thread (and NUMA node) that later works on it.
+        #pragma omp parallel for schedule(static)
+        for (size_t col = 0; col < shape[1]; col += 1) {
+            for(size_t row = 0; row < shape[0]; row += 1) {
+                bool ghost = (col == 0) || (row == 0) || (col == shape[1] - 1) || (row == shape[0] - 1);
+                buffer[(shape[0] * col) + row] = ghost ? 1.0f : std::clamp((img((col - 1), (row - 1)) / 255.0f), 0.0f, 1.0f);
             }
         }
 
@@ -366,7 +473,7 @@ public:
 
 private:
     std::vector< size_t > shape;
-    std::vector<ComponentType> buffer;
+    AlignedVector<ComponentType> buffer;
     std::vector< size_t > originalShape;
 
 };
@@ -1,5 +1,9 @@
 
+#include <cstring>
+#include <random>
 #include "Matrix.hpp"
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
 
 void check(bool condition, const std::string& msg)
 {
@@ -41,11 +45,128 @@ void test_assembleI(std::vector< std::pair< bool, std::string > >& results);
 
 // TODO: Decide on operator tests
 
+static Matrix< float > randomMatrix(size_t rows, size_t cols, std::mt19937 &gen)
+{
+    std::uniform_real_distribution< float > dist(-1.0f, 1.0f);
+    Matrix< float > m(rows, cols, 0.0f);
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+            m(i, j) = dist(gen);
+    return m;
+}
+
+// The scatter of the original prolongate(), run on one thread.
+static Matrix< float > scatterProlongate(const Matrix< float > &coarse, size_t rows, size_t cols)
+{
+    Matrix< float > prolongated(rows, cols, 0.0f);
+    for (size_t mat_col = 1; mat_col < coarse.cols() - 1; mat_col += 1) {
+        for (size_t mat_row = 1; mat_row < coarse.rows() - 1; mat_row += 1) {
+            prolongated.get(mat_row * 2, mat_col * 2) += coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2 + 1, mat_col * 2 + 1) += 0.25 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2 + 1, mat_col * 2 - 1) += 0.25 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2 - 1, mat_col * 2 - 1) += 0.25 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2 - 1, mat_col * 2 + 1) += 0.25 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2, mat_col * 2 - 1) += 0.5 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2, mat_col * 2 + 1) += 0.5 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2 - 1, mat_col * 2) += 0.5 * coarse.get(mat_row, mat_col);
+            prolongated.get(mat_row * 2 + 1, mat_col * 2) += 0.5 * coarse.get(mat_row, mat_col);
+        }
+    }
+    return prolongated;
+}
+
+static bool sameBits(const Matrix< float > &a, const Matrix< float > &b)
+{
+    return std::memcmp(a.data(), b.data(), a.rows() * a.cols() * sizeof(float)) == 0;
+}
+
+// prolongateAdd() (split and interleaved) against the original scatter
+// followed by +=, bit for bit.
+void test_prolongate(std::vector< std::pair< bool, std::string > >& results)
+{
+    std::mt19937 gen(3);
+    const std::vector< std::vector< size_t > > shapes = {{12, 13}, {102, 102}, {502, 502}, {482, 642}, {7, 9}};
+
+    for (const std::vector< size_t > &shape : shapes) {
+        const size_t rows = shape[0], cols = shape[1];
+        const size_t coarseRows = ((rows - 2) / 2) + 2, coarseCols = ((cols - 2) / 2) + 2;
+        const std::string name = std::to_string(rows) + "x" + std::to_string(cols);
+
+        Matrix< float > fineU = randomMatrix(rows, cols, gen), fineV = randomMatrix(rows, cols, gen);
+        Matrix< float > coarseU = randomMatrix(coarseRows, coarseCols, gen), coarseV = randomMatrix(coarseRows, coarseCols, gen);
+
+        Matrix< float > expectedU = fineU, expectedV = fineV;
+        expectedU += scatterProlongate(coarseU, rows, cols);
+        expectedV += scatterProlongate(coarseV, rows, cols);
+
+        Matrix< float > gathered = fineU;
+        gathered.prolongateAdd(coarseU);
+        results.push_back({sameBits(gathered, expectedU), "test_prolongate: Matrix::prolongateAdd " + name});
+
+        InterleavedUV interleaved(UV(fineU, fineV));
+        interleaved.prolongateAdd(InterleavedUV(UV(coarseU, coarseV)));
+        bool same = true;
+        for (size_t j = 0; j < cols; j++)
+            for (size_t i = 0; i < rows; i++)
+                same = same && (std::memcmp(&interleaved.u(i, j), &expectedU(i, j), sizeof(float)) == 0)
+                            && (std::memcmp(&interleaved.v(i, j), &expectedV(i, j), sizeof(float)) == 0);
+        results.push_back({same, "test_prolongate: InterleavedUV::prolongateAdd " + name});
+    }
+}
+
+// Ix, Iy and It as the original I(a, b) computed them, one loop per
+// derivative, with Ix and Iy divided by the grid spacing h.
+static I loopDerivatives(const Matrix< float > &a, const Matrix< float > &b, float h)
+{
+    Matrix< float > ix(a.rows(), a.cols(), 0.0f), iy(a.rows(), a.cols(), 0.0f), it(a.rows(), a.cols(), 0.0f);
+    float left, right;
+    for (size_t y = 0; y < (a.cols() - 1); y++)
+        for (size_t x = 0; x < (a.rows() - 1); x++) {
+            left = a(x, (y + 1)) - a(x, y) + a((x + 1), (y + 1)) - a((x + 1), y);
+            right = b(x, (y + 1)) - b(x, y) + b((x + 1), (y + 1)) - b((x + 1), y);
+            ix(x, y) = (0.25 / h) * (left + right);
+        }
+    for (size_t y = 0; y < (a.cols() - 1); y++)
+        for (size_t x = 0; x < (a.rows() - 1); x++) {
+            left = a((x + 1), y) - a(x, y) + a((x + 1), (y + 1)) - a(x, (y + 1));
+            right = b((x + 1), y) - b(x, y) + b((x + 1), (y + 1)) - b(x, (y + 1));
+            iy(x, y) = (0.25 / h) * (left + right);
+        }
+    for (size_t y = 0; y < (a.cols() - 1); y++)
+        for (size_t x = 0; x < (a.rows() - 1); x++) {
+            left = a(x, y) + a(x, (y + 1)) + a((x + 1), y) + a((x + 1), (y + 1));
+            right = b(x, y) + b(x, (y + 1)) + b((x + 1), y) + b((x + 1), (y + 1));
+            it(x, y) = 0.25 * (-left + right);
+        }
+    return I(std::move(ix), std::move(iy), std::move(it));
+}
+
+// The fused I(a, b, h) against the original loops, bit for bit; h = 4 is the
+// spacing of pyramid level 2.
+void test_assembleI(std::vector< std::pair< bool, std::string > >& results)
+{
+    std::mt19937 gen(13);
+    const std::vector< std::vector< size_t > > shapes = {{7, 9}, {12, 13}, {102, 101}, {482, 642}};
+
+    for (const std::vector< size_t > &shape : shapes) {
+        Matrix< float > a = randomMatrix(shape[0], shape[1], gen), b = randomMatrix(shape[0], shape[1], gen);
+        for (float h : {1.0f, 4.0f}) {
+            const std::string name = std::to_string(shape[0]) + "x" + std::to_string(shape[1]) + ", h = " + std::to_string(int(h));
+            I expected = loopDerivatives(a, b, h);
+            I fused(a, b, h);
+            results.push_back({sameBits(fused.x, expected.x) && sameBits(fused.y, expected.y) && sameBits(fused.t, expected.t),
+                               "test_assembleI: fused I(a, b, h) matches the separate loops " + name});
+        }
+    }
+}
+
 int main()
 {
     std::vector< std::pair< bool, std::string > > results;
 
     //test_matvec(results);
+    test_prolongate(results);
+    test_assembleI(results);
 
     size_t passed = 0;
     for (auto [condition, msg] : results)
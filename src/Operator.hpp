@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef OPERATOR
+#define OPERATOR
+
+#include <cassert>
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+
+// Matrix-free form of the Horn-Schunck system. In every interior cell
+//
+//     diagU * u - alpha * (sum of the 4 neighbours of u) + cross * v = f.u
+//     diagV * v - alpha * (sum of the 4 neighbours of v) + cross * u = f.v
+//
+// with diagU = Ix^2 + 4 alpha, diagV = Iy^2 + 4 alpha and cross = Ix * Iy
+// taken from the coefficient layout. The ghost layer of phi enters as
+// boundary values. This is the only place the stencil is written down; the
+// smoothers, residuals and Krylov kernels are built from it. Scalar is the
+// type the point formulas are evaluated in, by default that of the flow.
+template< FlowLayout Flow, CoefficientLayout Coeffs, class Scalar = FlowScalar<Flow> >
+class HornSchunckOperator
+{
+    public:
+        HornSchunckOperator() = delete;
+
+        // Layouts built for one alpha (Coefficients, PackedI) must be used
+        // with that alpha.
+        HornSchunckOperator(const Coeffs &c, float alpha) :
+            c(c), alpha(alpha)
+        {
+            if constexpr (requires { c.weight(); })
+                assert(c.weight() == alpha);
+        }
+
+        inline Scalar weight() const {
+            return alpha;
+        }
+
+        inline Scalar diagU(size_t i, size_t j) const {
+            return c.diagU(alpha, i, j);
+        }
+
+        inline Scalar diagV(size_t i, size_t j) const {
+            return c.diagV(alpha, i, j);
+        }
+
+        inline Scalar cross(size_t i, size_t j) const {
+            return c.cross(i, j);
+        }
+
+        inline Scalar neighboursU(const Flow &phi, size_t i, size_t j) const {
+            return Scalar(phi.u((i + 1), j)) + phi.u((i - 1), j) + phi.u(i, (j + 1)) + phi.u(i, (j - 1));
+        }
+
+        inline Scalar neighboursV(const Flow &phi, size_t i, size_t j) const {
+            return Scalar(phi.v((i + 1), j)) + phi.v((i - 1), j) + phi.v(i, (j + 1)) + phi.v(i, (j - 1));
+        }
+
+        // (A phi) in cell (i, j).
+        inline Scalar applyU(const Flow &phi, size_t i, size_t j) const {
+            return diagU(i, j) * phi.u(i, j) - alpha * neighboursU(phi, i, j) + cross(i, j) * phi.v(i, j);
+        }
+
+        inline Scalar applyV(const Flow &phi, size_t i, size_t j) const {
+            return diagV(i, j) * phi.v(i, j) - alpha * neighboursV(phi, i, j) + cross(i, j) * phi.u(i, j);
+        }
+
+        // (f - A phi) in cell (i, j).
+        inline Scalar residualU(const Flow &phi, const Flow &f, size_t i, size_t j) const {
+            return  + f.u(i, j)
+                    - diagU(i, j) * phi.u(i, j)
+                    + alpha * neighboursU(phi, i, j)
+                    - cross(i, j) * phi.v(i, j);
+        }
+
+        inline Scalar residualV(const Flow &phi, const Flow &f, size_t i, size_t j) const {
+            return  + f.v(i, j)
+                    - diagV(i, j) * phi.v(i, j)
+                    + alpha * neighboursV(phi, i, j)
+                    - cross(i, j) * phi.u(i, j);
+        }
+
+        // Gauss-Seidel value of u (resp. v) in (i, j) for the current neighbours.
+        inline Scalar relaxU(const Flow &phi, const Flow &f, size_t i, size_t j) const {
+            return (f.u(i, j) + alpha * neighboursU(phi, i, j) - cross(i, j) * phi.v(i, j))
+                   * Scalar(c.invDiagU(alpha, i, j));
+        }
+
+        inline Scalar relaxV(const Flow &phi, const Flow &f, size_t i, size_t j) const {
+            return (f.v(i, j) + alpha * neighboursV(phi, i, j) - cross(i, j) * phi.u(i, j))
+                   * Scalar(c.invDiagV(alpha, i, j));
+        }
+
+        // Solves the 2x2 point block [diagU cross; cross diagV] (u, v) = (bu, bv).
+        inline void solveBlock(size_t i, size_t j, Scalar bu, Scalar bv, Scalar &u, Scalar &v) const {
+            Scalar invDet = c.invDet(alpha, i, j);
+            u = (diagV(i, j) * bu - cross(i, j) * bv) * invDet;
+            v = (diagU(i, j) * bv - cross(i, j) * bu) * invDet;
+        }
+
+        // Coupled Gauss-Seidel update of (u, v) in (i, j).
+        inline void relaxBlock(Flow &phi, const Flow &f, size_t i, size_t j) const {
+            Scalar u, v;
+            solveBlock(i, j, f.u(i, j) + alpha * neighboursU(phi, i, j), f.v(i, j) + alpha * neighboursV(phi, i, j), u, v);
+            phi.u(i, j) = u;
+            phi.v(i, j) = v;
+        }
+
+    private:
+        const Coeffs &c;
+        Scalar alpha;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <memory>
 
 #include <omp.h>
 #include "solver.hpp"
@@ -11,110 +12,172 @@
 #include "FlowField.hpp"
 #include "ImgDer.hpp"
 #include "mg.hpp"
+#include "Convergence.hpp"
+#include "cg.hpp"
+#include "refine.hpp"
+#include "Sequence.hpp"
+#include "Timer.hpp"
 
 using namespace std;
 
 
-const float alpha = 1.0f;
-
-// TODO DELETE LATER - DEBUG PURPOSE
-#include <stdlib.h>
-double getTimeStamp()
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.e-9;
-}
-
-
-int main(int argc, char* argv[])
+// Iterates on phi until monitor stops the solver of config. A warm-started
+// phi is kept as initial guess, so FMG skips its nested iteration.
+static void solve(Flow &phi, Flow &f, IStorage &I, MultigridWorkspace &ws, const SolverConfig &config,
+				  ConvergenceMonitor &monitor, const Stopwatch &watch, bool warm)
 {
-	if (argc != 3 && argc != 5)
-		cout << "Wrong arguments!" << endl;
-
-	Matrix<float> a(argv[1]);
-	Matrix<float> b(argv[2]);
-
-	omp_set_num_threads(6);
-
-	// TODO DELETE LATER - DEBUG PURPOSE
-    double startStamp = getTimeStamp();
-
-	//calculate Ix, Iy and It
-	IStorage I(a, b);
-
-	//set up vectors
-	UV phi (a.getShape(), 0.0, a.getShape());
-	UV f (	((I(0).x * I(0).t) * -1.f),
-			((I(0).y * I(0).t) * -1.f)	);
-
-	//start calculation
-	UV res (a.getShape(), 0.0);
-	double resNorm;
-	if(true) {
-		for(size_t iteration = 0; iteration < 10000; iteration++)
+	const float alpha = config.alpha;
+	ResidualNorm resNorm;
+	if(config.solver == SolverType::CG) {
+		ConjugateGradient cg(I, ws, config);
+		cg.start(phi, f);
+		for(;;)
 		{
-			fCycle(phi, f, I, alpha, 0);
-
-			//norm testing
-			res = calcResidual(phi, f, I(0), alpha);
-			resNorm = res.u.l2Norm() + res.v.l2Norm();
-			std::cout << "residual norm: " << resNorm << "\n";
-			if(resNorm < 0.0005) {
+			resNorm = cg.iterate(phi);
+			std::cout << "residual norm: " << resNorm.l2 << "\n";
+			if(monitor.record(resNorm.l2, resNorm.linf, watch.seconds())) {
+				break;
+			}
+		}
+	}
+	else if(config.refine) {
+		IterativeRefinement refinement(I, ws, config);
+		refinement.start(phi, f);
+		for(;;)
+		{
+			resNorm = refinement.iterate();
+			std::cout << "residual norm: " << resNorm.l2 << "\n";
+			if(monitor.record(resNorm.l2, resNorm.linf, watch.seconds())) {
 				break;
 			}
 		}
+		refinement.solution(phi);
 	}
 	else {
-		for(size_t i = 0; i < 1000000; i++) {
-			for(size_t j = 1; j < (phi.u.cols() - 1); j++) {
-				for(size_t i = 1; i < (phi.u.rows() - 1); i++) {
-					phi.u(i, j) = (	- I(0).x(i, j) * I(0).t(i, j)
-									+ alpha * ( phi.u((i + 1), j) + phi.u((i - 1), j) + phi.u(i, (j + 1)) + phi.u(i, (j - 1)) )
-									- (I(0).x(i,j) * I(0).y(i,j) * phi.v(i,j))
-								)
-								/ ((I(0).x(i,j) * I(0).x(i,j)) + (4.0 * alpha));
-
-					phi.v(i, j) = ( - I(0).y(i, j) * I(0).t(i, j)
-									+ alpha * ( phi.v((i + 1), j) + phi.v((i - 1), j) + phi.v(i, (j + 1)) + phi.v(i, (j - 1)))
-									- (I(0).x(i, j) * I(0).y(i, j) * phi.u(i, j))
-								)
-								/ ((I(0).y(i, j) * I(0).y(i, j)) + (4.0 * alpha));
-				}
+		for(size_t iteration = 0; ; iteration++)
+		{
+			switch (config.cycle) {
+				case CycleType::V:
+					vCycle(phi, f, I, ws, config, 0);
+					break;
+				case CycleType::W:
+					wCycle(phi, f, I, ws, config, 0);
+					break;
+				case CycleType::FMG:
+					//nested iteration for the initial guess, F-cycles afterwards
+					if (iteration == 0 && !warm) {
+						fmg(phi, f, I, ws, config);
+						break;
+					}
+					fCycle(phi, f, I, ws, config, 0);
+					break;
+				default:
+					fCycle(phi, f, I, ws, config, 0);
 			}
 
 			//norm testing
-			if(i%100 == 0) {
-				res = calcResidual(phi, f, I(0), alpha);
-				resNorm = res.u.l2Norm() + res.v.l2Norm();
-				std::cout << "residual norm: " << resNorm << "\n";
-				if(resNorm < 0.0005) {
-					break;
-				}
+			if (config.laggedNorm)
+				resNorm = ws.fineResidual;
+			else
+				resNorm = residualNorm(phi, f, levelCoefficients(I, 0), alpha);
+			std::cout << "residual norm: " << resNorm.l2 << "\n";
+			if(monitor.record(resNorm.l2, resNorm.linf, watch.seconds())) {
+				break;
 			}
 		}
 	}
+}
+
+// "history.json" -> "history_3.json" for pair 3 of a sequence.
+static string pairPath(const string &path, size_t pair)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if(dot == string::npos || (slash != string::npos && dot < slash))
+		return path + "_" + to_string(pair);
+	return path.substr(0, dot) + "_" + to_string(pair) + path.substr(dot);
+}
+
+int main(int argc, char* argv[])
+{
+	vector<string> files;
+	SolverConfig config = parseConfig(argc, argv, files);
+	if (config.sequence ? (files.size() < 2) : (files.size() != 2 && files.size() != 4 && files.size() != 5)) {
+		cout << "Wrong arguments!" << endl << usage();
+		return 1;
+	}
+	const float alpha = config.alpha;
+	setupThreads(config.flushDenormals);
 
+	vector<string> frames = files;
+	if (!config.sequence)
+		frames.resize(2);
+	FrameCache cache(frames, config.pyramid);
 
-	// TODO DELETE LATER - DEBUG PURPOSE
-    double endStamp = getTimeStamp();
-    double timeDifference = endStamp-startStamp;
-    std::cout << "Total time is "<< timeDifference << std::endl;
+	// kept across the pairs of a sequence, which all have the size of the first frame
+	unique_ptr<MultigridWorkspace> ws;
+	unique_ptr<Flow> previous;
 
-	phi.normalize();
+	do {
+		Stopwatch watch;
 
-	//print
-	string nameU = "resultU.bmp";
-	string nameV = "resultV.bmp";
-	if (argc > 4) {
-		nameU = argv[3];
-		nameV = argv[4];
-	}
-	phi.writeToImage(nameU, nameV);
+		if (cache.first()(0).getShape() != cache.second()(0).getShape()) {
+			cout << "Frames " << cache.pair() << " and " << cache.pair() + 1 << " differ in size!" << endl;
+			return 1;
+		}
 
-	//compare
-	if(false)
-		std::cout << "Difference to reference: "
-				  << phi.compare(argv[1], true) << " (L2), "
-				  << phi.compare(argv[1], false) << "(Linf)" << std::endl;
+		//calculate Ix, Iy and It
+		IStorage I(cache.first(), cache.second(), config.pyramid);
+		prepareCoefficients(I, alpha);
+		vector<size_t> shape = I(0).x.getShape();
+		if (ws)
+			ws->rebind();
+		else
+			ws = make_unique<MultigridWorkspace>(I, config.levelThreads);
+
+		//set up vectors
+		Flow phi (shape, 0.0, shape);
+		bool warm = previous && (config.warmStart != WarmStart::None);
+		if (warm)
+			warmStart(phi, *previous, config.warmStart);
+		Flow f (UV(	((I(0).x * I(0).t) * -1.f),
+					((I(0).y * I(0).t) * -1.f)	));
+
+		//start calculation
+		ResidualNorm resNorm = residualNorm(phi, f, levelCoefficients(I, 0), alpha);
+		ConvergenceMonitor monitor(config, resNorm.l2);
+		solve(phi, f, I, *ws, config, monitor, watch, warm);
+
+		std::cout << "Total time is "<< watch.seconds() << std::endl;
+
+		std::cout << "Stopped (" << toString(monitor.reason()) << ") after " << monitor.history().size()
+				  << " cycles, mean convergence factor " << monitor.meanFactor() << std::endl;
+		string historyPath = config.sequence ? pairPath(config.historyPath, cache.pair()) : config.historyPath;
+		if (!config.historyPath.empty() && !monitor.write(historyPath))
+			std::cout << "Could not write " << historyPath << std::endl;
+
+		UV result = toUV(phi);
+		result.normalize();
+		if (config.warmStart != WarmStart::None)
+			previous = make_unique<Flow>(std::move(phi));
+
+		//print
+		string nameU = "resultU.bmp";
+		string nameV = "resultV.bmp";
+		if (config.sequence) {
+			nameU = config.outputPrefix + "U" + to_string(cache.pair()) + ".bmp";
+			nameV = config.outputPrefix + "V" + to_string(cache.pair()) + ".bmp";
+		}
+		else if (files.size() > 3) {
+			nameU = files[2];
+			nameV = files[3];
+		}
+		result.writeToImage(nameU, nameV);
+
+		//compare
+		if(config.compare)
+			std::cout << "Difference to reference: "
+					  << result.compare(cache.firstPath(), true) << " (L2), "
+					  << result.compare(cache.firstPath(), false) << "(Linf)" << std::endl;
+	} while (cache.advance());
 }
@@ -0,0 +1,200 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include "solver.hpp"
+#include "simd.hpp"
+
+void check(bool condition, const std::string& msg)
+{
+    if (!condition)
+    {
+        std::cout << "FAILED: " << msg << "\n";
+    }
+    else
+    {
+        std::cout << "PASSED: " << msg << "\n";
+    }
+}
+
+static Matrix<float> randomMatrix(size_t rows, size_t cols, float scale, std::mt19937 &generator)
+{
+    std::uniform_real_distribution<float> distribution(-scale, scale);
+    Matrix<float> m(rows, cols, 0.0f);
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+            m(i, j) = distribution(generator);
+    return m;
+}
+
+// Distance of a and b in units in the last place.
+static uint32_t ulps(float a, float b)
+{
+    int32_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(float));
+    std::memcpy(&ib, &b, sizeof(float));
+    if (ia < 0)
+        ia = INT32_MIN - ia;
+    if (ib < 0)
+        ib = INT32_MIN - ib;
+    return uint32_t(ia > ib ? int64_t(ia) - ib : int64_t(ib) - ia);
+}
+
+static uint32_t maxUlps(const UV &a, const UV &b)
+{
+    uint32_t worst = 0;
+    for (size_t j = 0; j < a.cols(); j++)
+        for (size_t i = 0; i < a.rows(); i++)
+            worst = std::max({worst, ulps(a.u(i, j), b.u(i, j)), ulps(a.v(i, j), b.v(i, j))});
+    return worst;
+}
+
+static const std::vector< std::pair< SimdLevel, std::string > > &levels()
+{
+    static const std::vector< std::pair< SimdLevel, std::string > > all = {
+        {SimdLevel::Scalar, "scalar"}, {SimdLevel::AVX2, "avx2"}, {SimdLevel::AVX512, "avx512"}};
+    return all;
+}
+
+static bool supported(SimdLevel level)
+{
+    if (level == SimdLevel::AVX512)
+        return __builtin_cpu_supports("avx512f");
+    if (level == SimdLevel::AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return true;
+}
+
+// The compacted smoother against the templated rbgs on the same level, for
+// odd and even sizes and every instruction set the CPU has.
+void test_equivalence(std::vector< std::pair< bool, std::string > >& results)
+{
+    std::mt19937 generator(7);
+    const float alpha = 0.5f;
+
+    for (auto [rows, cols] : std::vector< std::pair< size_t, size_t > >{{7, 9}, {12, 13}, {37, 22}, {102, 102}, {131, 70}}) {
+        I derivatives(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator),
+                      randomMatrix(rows, cols, 1.0f, generator));
+        Coefficients c(derivatives, alpha);
+        UV phi(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator));
+        UV f(randomMatrix(rows, cols, 0.1f, generator), randomMatrix(rows, cols, 0.1f, generator));
+
+        UV expected = phi;
+        rbgs(expected, f, c, alpha, 3);
+
+        RedBlackLevel level(rows, cols);
+        level.bind(c);
+        for (auto [simd, name] : levels()) {
+            if (!supported(simd))
+                continue;
+            UV actual = phi;
+            level.smooth(actual, f, alpha, 3, simd);
+            std::string size = std::to_string(rows) + "x" + std::to_string(cols);
+            results.push_back({maxUlps(expected, actual) == 0, "test_equivalence: " + name + " matches rbgs bitwise on " + size});
+        }
+    }
+}
+
+// The temporally blocked rbgs and blockRbgs against nSweeps single sweeps,
+// for odd and even shapes and several team sizes; the wide shapes take the
+// trapezoid path of wavefront() with every team size, the narrow ones the
+// column-parallel fallback.
+void test_temporalBlocking(std::vector< std::pair< bool, std::string > >& results)
+{
+    std::mt19937 generator(11);
+    const float alpha = 0.5f;
+    const int maxThreads = omp_get_max_threads();
+    omp_set_dynamic(0);
+
+    for (auto [rows, cols] : std::vector< std::pair< size_t, size_t > >{{7, 9}, {12, 13}, {37, 22}, {41, 290}, {30, 331}}) {
+        I derivatives(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator),
+                      randomMatrix(rows, cols, 1.0f, generator));
+        Coefficients c(derivatives, alpha);
+        UV phi(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator));
+        UV f(randomMatrix(rows, cols, 0.1f, generator), randomMatrix(rows, cols, 0.1f, generator));
+        std::string size = std::to_string(rows) + "x" + std::to_string(cols);
+
+        for (size_t sweeps : {1, 2, 5}) {
+            UV rbgsExpected = phi, blockExpected = phi;
+            for (size_t sweep = 0; sweep < sweeps; sweep++) {
+                rbgs(rbgsExpected, f, c, alpha);
+                blockRbgs(blockExpected, f, c, alpha);
+            }
+
+            bool rbgsSame = true, blockSame = true;
+            for (int threads : {1, 2, 3, 4, 7}) {
+                omp_set_num_threads(threads);
+                UV rbgsActual = phi, blockActual = phi;
+                rbgs(rbgsActual, f, c, alpha, sweeps);
+                blockRbgs(blockActual, f, c, alpha, sweeps);
+                rbgsSame = rbgsSame && (maxUlps(rbgsExpected, rbgsActual) == 0);
+                blockSame = blockSame && (maxUlps(blockExpected, blockActual) == 0);
+            }
+            std::string what = std::to_string(sweeps) + " sweeps on " + size + " with 1-7 threads";
+            results.push_back({rbgsSame, "test_temporalBlocking: blocked rbgs matches single sweeps bitwise, " + what});
+            results.push_back({blockSame, "test_temporalBlocking: blocked blockRbgs matches single sweeps bitwise, " + what});
+        }
+    }
+    omp_set_num_threads(maxThreads);
+}
+
+// Optional timing, FLOW_TEST_BENCH=1: smoothing steps of 5 sweeps as in the
+// cycles, with rbgs and with the compacted kernels (packing included), on the
+// level sizes of a 1024x1024 image.
+void benchmark()
+{
+    std::mt19937 generator(7);
+    const size_t steps = 8, sweeps = 5;
+    const float alpha = 0.5f;
+
+    for (size_t n : {66, 130, 258, 514, 1026}) {
+        I derivatives(randomMatrix(n, n, 1.0f, generator), randomMatrix(n, n, 1.0f, generator),
+                      randomMatrix(n, n, 1.0f, generator));
+        Coefficients c(derivatives, alpha);
+        UV phi(Matrix<float>(n, n, 0.0f), Matrix<float>(n, n, 0.0f));
+        UV f(randomMatrix(n, n, 0.1f, generator), randomMatrix(n, n, 0.1f, generator));
+
+        auto time = [&](auto run) {
+            run();
+            auto start = std::chrono::steady_clock::now();
+            for (size_t step = 0; step < steps; step++)
+                run();
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / (steps * sweeps) * 1e3;
+        };
+        std::cout << n << "x" << n << " rbgs: " << time([&]() { rbgs(phi, f, c, alpha, sweeps); }) << " ms per sweep\n";
+        RedBlackLevel level(n, n);
+        level.bind(c);
+        for (auto [simd, name] : levels())
+            if (supported(simd))
+                std::cout << n << "x" << n << " " << name << ": "
+                          << time([&]() { level.smooth(phi, f, alpha, sweeps, simd); }) << " ms per sweep\n";
+    }
+}
+
+int main()
+{
+    std::vector< std::pair< bool, std::string > > results;
+
+    test_equivalence(results);
+    test_temporalBlocking(results);
+
+    const char *bench = std::getenv("FLOW_TEST_BENCH");
+    if (bench != nullptr && bench[0] == '1')
+        benchmark();
+
+    size_t passed = 0;
+    for (auto [condition, msg] : results)
+    {
+        check(condition, msg);
+        if (condition)
+        {
+            passed++;
+        }
+    }
+
+    std::cout << "--- " << passed << "/" << results.size() << " checks passed ---" << std::endl;
+
+    return passed != results.size();
+}
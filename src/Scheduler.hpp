@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <omp.h>
+#include <pmmintrin.h>
+#include <xmmintrin.h>
+
+// Fixes the team size and optionally flushes denormals on every thread;
+// called once by main before any solver object exists.
+inline void setupThreads(bool flushDenormals)
+{
+    omp_set_dynamic(0);
+    #pragma omp parallel
+    {
+        if(flushDenormals) {
+            _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+            _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+        }
+    }
+}
+
+// Chooses the OpenMP team size per multigrid level: fixed counts if given,
+// otherwise the fastest of max, max/2, ..., 1 threads (see README).
+class LevelScheduler
+{
+    public:
+        LevelScheduler() = delete;
+
+        LevelScheduler(const std::vector<size_t> &cells, const std::vector<size_t> &fixed = {},
+                       size_t minCells = 625, size_t samples = 3) :
+            maxThreads(omp_get_max_threads()),
+            current(0),
+            samplesPerCandidate(samples)
+        {
+            for(size_t c = maxThreads; c > 1; c /= 2)
+                candidates.push_back(c);
+            candidates.push_back(1);
+
+            static bool warned = false;
+            if(!warned && std::any_of(fixed.begin(), fixed.end(), [&](size_t threads) { return threads > maxThreads; })) {
+                std::cout << "Limiting the thread counts to " << maxThreads << " available threads" << std::endl;
+                warned = true;
+            }
+
+            for(size_t level = 0; level < cells.size(); level++) {
+                LevelState state;
+                if(!fixed.empty()) {
+                    state.calibrated = true;
+                    state.threads = std::min(fixed[std::min(level, fixed.size() - 1)], maxThreads);
+                }
+                else {
+                    state.calibrated = (cells[level] < minCells) || (maxThreads == 1);
+                    state.threads = state.calibrated ? 1 : candidates[0];
+                }
+                states.push_back(state);
+            }
+        }
+
+        // Sets the thread count of level; does nothing if it is already active.
+        inline void enter(size_t level) {
+            size_t threads = states[level].threads;
+            if(threads != current) {
+                omp_set_num_threads(threads);
+                current = threads;
+            }
+        }
+
+        // Runs one timed unit of work (a smoothing step) on level.
+        template< class Work >
+        inline void run(size_t level, Work work) {
+            enter(level);
+            LevelState &state = states[level];
+            if(state.calibrated) {
+                work();
+                return;
+            }
+
+            double start = omp_get_wtime();
+            work();
+            record(state, omp_get_wtime() - start);
+        }
+
+        inline size_t threads(size_t level) const {
+            return states[level].threads;
+        }
+
+        inline size_t levels() const {
+            return states.size();
+        }
+
+        // Largest team any level can be given.
+        inline size_t largestTeam() const {
+            size_t team = candidates[0];
+            for(const LevelState &state : states)
+                team = std::max(team, state.threads);
+            return team;
+        }
+
+    private:
+        struct LevelState {
+            size_t threads = 1;
+            size_t candidate = 0;
+            size_t samples = 0;
+            double elapsed = 0.;
+            double bestTime = 0.;
+            size_t bestThreads = 1;
+            bool calibrated = true;
+        };
+
+        // The first call of every candidate is a warm-up and not counted.
+        inline void record(LevelState &state, double seconds) {
+            if(state.samples++ == 0)
+                return;
+            state.elapsed += seconds;
+            if(state.samples <= samplesPerCandidate)
+                return;
+
+            double average = state.elapsed / samplesPerCandidate;
+            if((state.candidate == 0) || (average < state.bestTime)) {
+                state.bestTime = average;
+                state.bestThreads = state.threads;
+            }
+
+            state.samples = 0;
+            state.elapsed = 0.;
+            if(++state.candidate < candidates.size()) {
+                state.threads = candidates[state.candidate];
+            }
+            else {
+                state.threads = state.bestThreads;
+                state.calibrated = true;
+            }
+        }
+
+        size_t maxThreads;
+        size_t current;
+        size_t samplesPerCandidate;
+        std::vector<size_t> candidates;
+        std::vector<LevelState> states;
+};
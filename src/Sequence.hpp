@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+#include "Matrix.hpp"
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+#include "Config.hpp"
+
+// Walks the frames of a sequence as the pairs (f0, f1), (f1, f2), ... Every
+// frame is loaded and its pyramid built once: the second pyramid of a pair
+// is kept as the first one of the next pair.
+class FrameCache
+{
+    public:
+        FrameCache() = delete;
+
+        FrameCache(const std::vector<std::string> &paths, Pyramid pyramid) :
+            paths(paths),
+            pyramid(pyramid),
+            index(0)
+        {
+            previous.emplace(load(0));
+            next.emplace(load(1));
+        }
+
+        // Moves on to the next pair; returns false after the last one.
+        inline bool advance() {
+            if(index + 2 >= paths.size())
+                return false;
+            index++;
+            previous = std::move(next);
+            next.emplace(load(index + 1));
+            return true;
+        }
+
+        inline const FramePyramid& first() const {
+            return *previous;
+        }
+
+        inline const FramePyramid& second() const {
+            return *next;
+        }
+
+        // Index of the current pair, i.e. of its first frame.
+        inline size_t pair() const {
+            return index;
+        }
+
+        inline const std::string& firstPath() const {
+            return paths[index];
+        }
+
+    private:
+        inline FramePyramid load(size_t frame) const {
+            return FramePyramid(Matrix<float>(paths[frame].c_str()), pyramid);
+        }
+
+        std::vector<std::string> paths;
+        Pyramid pyramid;
+        size_t index;
+        std::optional<FramePyramid> previous;
+        std::optional<FramePyramid> next;
+};
+
+// Initial guess for the next pair of a sequence from the flow of the
+// previous one. WarmStart::Warped moves the flow along itself, assuming
+// constant motion: every cell takes the previous flow at the point it came
+// from, x - previous(x), interpolated bilinearly and clamped to the interior.
+// u is the displacement along the columns and v along the rows.
+template< FlowLayout Flow >
+void warmStart(Flow &phi, const Flow &previous, WarmStart mode)
+{
+    if(mode == WarmStart::None) {
+        phi.fill(0.0);
+        return;
+    }
+
+    phi = previous;
+    if(mode == WarmStart::Previous)
+        return;
+
+    const float maxRow = float(phi.rows() - 2);
+    const float maxCol = float(phi.cols() - 2);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (phi.cols() - 1); j++)
+        for(size_t i = 1; i < (phi.rows() - 1); i++) {
+            float row = std::clamp(float(i) - float(previous.v(i, j)), 1.0f, maxRow);
+            float col = std::clamp(float(j) - float(previous.u(i, j)), 1.0f, maxCol);
+            size_t r0 = std::min(size_t(row), size_t(maxRow) - 1);
+            size_t c0 = std::min(size_t(col), size_t(maxCol) - 1);
+            float wr = row - float(r0);
+            float wc = col - float(c0);
+
+            phi.u(i, j) = (1.0f - wc) * ((1.0f - wr) * previous.u(r0, c0) + wr * previous.u(r0 + 1, c0))
+                        + wc * ((1.0f - wr) * previous.u(r0, c0 + 1) + wr * previous.u(r0 + 1, c0 + 1));
+            phi.v(i, j) = (1.0f - wc) * ((1.0f - wr) * previous.v(r0, c0) + wr * previous.v(r0 + 1, c0))
+                        + wc * ((1.0f - wr) * previous.v(r0, c0 + 1) + wr * previous.v(r0 + 1, c0 + 1));
+        }
+}
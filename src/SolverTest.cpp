@@ -0,0 +1,135 @@
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include "solver.hpp"
+#include "CoarseSolver.hpp"
+
+void check(bool condition, const std::string& msg)
+{
+    if (!condition)
+    {
+        std::cout << "FAILED: " << msg << "\n";
+    }
+    else
+    {
+        std::cout << "PASSED: " << msg << "\n";
+    }
+}
+
+static Matrix<float> randomMatrix(size_t rows, size_t cols, float scale, std::mt19937 &generator)
+{
+    std::uniform_real_distribution<float> distribution(-scale, scale);
+    Matrix<float> m(rows, cols, 0.0f);
+    for (size_t j = 0; j < cols; j++)
+        for (size_t i = 0; i < rows; i++)
+            m(i, j) = distribution(generator);
+    return m;
+}
+
+static bool sameBits(const UV &a, const UV &b)
+{
+    const size_t bytes = a.rows() * a.cols() * sizeof(float);
+    return (std::memcmp(a.u.data(), b.u.data(), bytes) == 0) && (std::memcmp(a.v.data(), b.v.data(), bytes) == 0);
+}
+
+// calcResidualRestricted against calcResidual followed by restrictInto, for
+// odd and even shapes and several team sizes, also with column buffers that
+// have room for fewer threads than the team.
+void test_residualRestricted(std::vector< std::pair< bool, std::string > >& results)
+{
+    std::mt19937 generator(5);
+    const float alpha = 0.5f;
+    const int maxThreads = omp_get_max_threads();
+    omp_set_dynamic(0);
+
+    for (auto [rows, cols] : std::vector< std::pair< size_t, size_t > >{{7, 9}, {12, 13}, {37, 22}, {102, 101}, {131, 70}}) {
+        I derivatives(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator),
+                      randomMatrix(rows, cols, 1.0f, generator));
+        Coefficients c(derivatives, alpha);
+        UV phi(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator));
+        UV f(randomMatrix(rows, cols, 0.1f, generator), randomMatrix(rows, cols, 0.1f, generator));
+        const std::vector<size_t> coarseShape = {((rows - 2) / 2) + 2, ((cols - 2) / 2) + 2};
+        const std::string size = std::to_string(rows) + "x" + std::to_string(cols);
+
+        UV residual(phi.getShape(), 0.0);
+        calcResidual(residual, phi, f, c, alpha);
+        UV expected(coarseShape, 0.0);
+        residual.restrictInto(expected);
+        const ResidualNorm expectedNorm = flowNorm(residual);
+
+        bool same = true, sameNorm = true;
+        for (int threads : {1, 2, 3, 4}) {
+            for (int room : {threads, 2}) {
+                omp_set_num_threads(threads);
+                AlignedVector<float> columns(room * residualColumnsStride(rows));
+                UV actual(coarseShape, 0.0);
+                ResidualNorm norm;
+                calcResidualRestricted(actual, phi, f, c, alpha, columns, &norm);
+                same = same && sameBits(expected, actual);
+                sameNorm = sameNorm && (norm.linf == expectedNorm.linf)
+                                    && (std::abs(norm.l2 - expectedNorm.l2) <= 1e-6f * expectedNorm.l2);
+            }
+        }
+        results.push_back({same, "test_residualRestricted: matches calcResidual + restrictInto bitwise on " + size});
+        results.push_back({sameNorm, "test_residualRestricted: norms match flowNorm of the residual on " + size});
+    }
+    omp_set_num_threads(maxThreads);
+}
+
+// The direct solve against what it replaced: Gauss-Seidel sweeps on the
+// level until they have converged, with random ghost values as boundary.
+void test_coarseSolver(std::vector< std::pair< bool, std::string > >& results)
+{
+    std::mt19937 generator(9);
+    const float alpha = 0.5f;
+
+    for (auto [rows, cols] : std::vector< std::pair< size_t, size_t > >{{5, 5}, {7, 9}, {12, 13}, {22, 17}}) {
+        I derivatives(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator),
+                      randomMatrix(rows, cols, 1.0f, generator));
+        Coefficients c(derivatives, alpha);
+        UV boundary(randomMatrix(rows, cols, 1.0f, generator), randomMatrix(rows, cols, 1.0f, generator));
+        UV f(randomMatrix(rows, cols, 0.1f, generator), randomMatrix(rows, cols, 0.1f, generator));
+        const std::string size = std::to_string(rows) + "x" + std::to_string(cols);
+
+        UV expected = boundary;
+        for (size_t sweep = 0; sweep < 5000; sweep++)
+            gaussSeidel(expected, f, c, alpha);
+
+        CoarseSolver solver;
+        solver.factorise(HornSchunckOperator<UV, Coefficients>(c, alpha), rows, cols);
+        UV actual = boundary;
+        solver.solve(actual, f);
+
+        float difference = 0.0f, largest = 0.0f;
+        for (size_t j = 0; j < cols; j++)
+            for (size_t i = 0; i < rows; i++) {
+                difference = std::max({difference, std::abs(actual.u(i, j) - expected.u(i, j)), std::abs(actual.v(i, j) - expected.v(i, j))});
+                largest = std::max({largest, std::abs(expected.u(i, j)), std::abs(expected.v(i, j))});
+            }
+        results.push_back({difference <= 1e-5f * largest, "test_coarseSolver: matches converged Gauss-Seidel on " + size});
+        results.push_back({residualNorm(actual, f, c, alpha).linf <= 1e-5f, "test_coarseSolver: residual vanishes on " + size});
+    }
+}
+
+int main()
+{
+    std::vector< std::pair< bool, std::string > > results;
+
+    test_residualRestricted(results);
+    test_coarseSolver(results);
+
+    size_t passed = 0;
+    for (auto [condition, msg] : results)
+    {
+        check(condition, msg);
+        if (condition)
+        {
+            passed++;
+        }
+    }
+
+    std::cout << "--- " << passed << "/" << results.size() << " checks passed ---" << std::endl;
+
+    return passed != results.size();
+}
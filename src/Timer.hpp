@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+
+// Wall-clock time since construction, for the run time of a solve and the
+// time stamps of the convergence history.
+class Stopwatch
+{
+    public:
+        Stopwatch() :
+            start(std::chrono::steady_clock::now())
+            { }
+
+        inline double seconds() const {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "Matrix.hpp"
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+#include "Layout.hpp"
+#include "Scheduler.hpp"
+#include "CoarseSolver.hpp"
+#include "solver.hpp"
+#include "simd.hpp"
+
+// Per-level buffers used by the multigrid cycles. Built once per IStorage so
+// that a cycle only fills and overwrites memory instead of allocating it.
+class MultigridWorkspace
+{
+    public:
+        MultigridWorkspace() = delete;
+
+        // threads fixes the thread count per level, see LevelScheduler.
+        MultigridWorkspace(const IStorage &II, const std::vector<size_t> &threads = {}) :
+            scheduler(levelCells(II), threads)
+        {
+            for(size_t level = 1; level < II.levels(); level++) {
+                std::vector<size_t> shape = II(level).x.getShape();
+                std::vector<size_t> fineShape = II(level - 1).x.getShape();
+                corrections.push_back(Flow(shape, 0.0, fineShape));
+                rhs.push_back(Flow(shape, 0.0, fineShape));
+            }
+            for(size_t level = 0; level + 1 < II.levels(); level++) {
+                size_t stride = residualColumnsStride(II(level).x.rows());
+                residualColumns.push_back(AlignedVector<float>(scheduler.largestTeam() * stride));
+            }
+            redBlackLevels.resize(II.levels());
+        }
+
+        // Coarse-grid correction of the given level (level >= 1).
+        inline Flow& eps(size_t level) {
+            return corrections[level - 1];
+        }
+
+        // Restricted right-hand side of the given level (level >= 1).
+        inline Flow& f(size_t level) {
+            return rhs[level - 1];
+        }
+
+        // Per-thread column buffers of calcResidualRestricted on the given
+        // level (level < levels() - 1), sized for the largest team of the scheduler.
+        inline AlignedVector<float>& columns(size_t level) {
+            return residualColumns[level];
+        }
+
+        inline size_t levels() const {
+            return corrections.size() + 1;
+        }
+
+        // Direct solver of the level the cycles stop at, factorised on first use
+        // from the same coefficients the smoothers of that level use.
+        template< CoefficientLayout Coeffs >
+        inline CoarseSolver& direct(const Coeffs &c, size_t rows, size_t cols, float alpha) {
+            if(!coarse.matches(rows, cols, alpha))
+                coarse.factorise(HornSchunckOperator<Flow, Coeffs>(c, alpha), rows, cols);
+            return coarse;
+        }
+
+        // Compacted copy of the given level for the vectorised red-black
+        // smoother, allocated and bound to c on first use (only for levels
+        // that RedBlackLevel::fitsCache).
+        inline RedBlackLevel& redBlack(size_t level, const Coefficients &c) {
+            std::unique_ptr<RedBlackLevel> &rb = redBlackLevels[level];
+            if(!rb)
+                rb = std::make_unique<RedBlackLevel>(c.rows(), c.cols());
+            if(!rb->isBound())
+                rb->bind(c);
+            return *rb;
+        }
+
+        // Prepares the workspace for a new IStorage of the same shape (the next
+        // frame pair of a sequence). The buffers and the thread counts of the
+        // scheduler carry over; only the coarse factorisation is redone.
+        inline void rebind() {
+            coarse.reset();
+            for(std::unique_ptr<RedBlackLevel> &rb : redBlackLevels)
+                if(rb)
+                    rb->unbind();
+        }
+
+        LevelScheduler scheduler;
+
+        // Norms of the finest residual seen by the first restriction of the
+        // last cycle, i.e. of the solution after its pre-smoothing.
+        ResidualNorm fineResidual;
+
+    private:
+        static std::vector<size_t> levelCells(const IStorage &II) {
+            std::vector<size_t> cells;
+            for(size_t level = 0; level < II.levels(); level++)
+                cells.push_back(II(level).x.rows() * II(level).x.cols());
+            return cells;
+        }
+
+        std::vector<Flow> corrections;
+        std::vector<Flow> rhs;
+        std::vector<AlignedVector<float>> residualColumns;
+        CoarseSolver coarse;
+        std::vector<std::unique_ptr<RedBlackLevel>> redBlackLevels;
+};
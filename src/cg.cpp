@@ -0,0 +1,101 @@
+#include "cg.hpp"
+#include "mg.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Dot product over the interior.
+static double dot(const Flow &a, const Flow &b)
+{
+    double sum = 0.;
+
+    #pragma omp parallel for schedule(static) reduction(+:sum)
+    for(size_t j = 1; j < (a.cols() - 1); j++)
+        for(size_t i = 1; i < (a.rows() - 1); i++)
+            sum += double(a.u(i, j)) * b.u(i, j) + double(a.v(i, j)) * b.v(i, j);
+
+    return sum;
+}
+
+ConjugateGradient::ConjugateGradient(const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config) :
+    II(II),
+    ws(ws),
+    config(config),
+    r(II(0).x.getShape(), 0.0),
+    z(II(0).x.getShape(), 0.0),
+    p(II(0).x.getShape(), 0.0),
+    q(II(0).x.getShape(), 0.0),
+    rz(0.)
+{ }
+
+void ConjugateGradient::precondition()
+{
+    switch(config.preconditioner) {
+        case Preconditioner::Jacobi:
+            blockJacobi(z, r, levelCoefficients(II, 0), config.alpha);
+            break;
+        case Preconditioner::Multigrid:
+            z.fill(0.0);
+            vCycle(z, r, II, ws, config, 0);
+            break;
+        default:
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 1; j < (r.cols() - 1); j++)
+                for(size_t i = 1; i < (r.rows() - 1); i++) {
+                    z.u(i, j) = r.u(i, j);
+                    z.v(i, j) = r.v(i, j);
+                }
+    }
+}
+
+ResidualNorm ConjugateGradient::start(const Flow &phi, const Flow &f)
+{
+    ws.scheduler.enter(0);
+    calcResidual(r, phi, f, levelCoefficients(II, 0), config.alpha);
+    precondition();
+    ws.scheduler.enter(0);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (p.cols() - 1); j++)
+        for(size_t i = 1; i < (p.rows() - 1); i++) {
+            p.u(i, j) = z.u(i, j);
+            p.v(i, j) = z.v(i, j);
+        }
+
+    rz = dot(r, z);
+    return flowNorm(r);
+}
+
+ResidualNorm ConjugateGradient::iterate(Flow &phi)
+{
+    ws.scheduler.enter(0);
+    applyOperator(q, p, levelCoefficients(II, 0), config.alpha);
+    const double a = rz / dot(p, q);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (p.cols() - 1); j++)
+        for(size_t i = 1; i < (p.rows() - 1); i++) {
+            phi.u(i, j) += a * p.u(i, j);
+            phi.v(i, j) += a * p.v(i, j);
+            r.u(i, j) -= a * q.u(i, j);
+            r.v(i, j) -= a * q.v(i, j);
+        }
+
+    precondition();
+    ws.scheduler.enter(0);
+
+    // z . r_new and z . q give z . (r_new - r_old) = -a * z . q
+    const double rzNew = dot(r, z);
+    const double beta = (-a * dot(z, q)) / rz;
+    rz = rzNew;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (p.cols() - 1); j++)
+        for(size_t i = 1; i < (p.rows() - 1); i++) {
+            p.u(i, j) = z.u(i, j) + beta * p.u(i, j);
+            p.v(i, j) = z.v(i, j) + beta * p.v(i, j);
+        }
+
+    return flowNorm(r);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef CONJUGATE_GRADIENT
+#define CONJUGATE_GRADIENT
+
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+#include "Layout.hpp"
+#include "Workspace.hpp"
+#include "Config.hpp"
+#include "solver.hpp"
+
+// Preconditioned conjugate gradients on the finest level. The preconditioner
+// is selected by config.preconditioner: none, point-block Jacobi, or one
+// V-cycle with zero initial guess (MGPCG). A V-cycle with red-black smoothing
+// is not exactly symmetric, so beta uses the flexible Polak-Ribiere form
+// beta = z_new . (r_new - r_old) / (z_old . r_old), which needs no extra
+// vector because r_old = r_new + a * A p. All vector updates touch the
+// interior only, so the ghost layer of p stays zero.
+class ConjugateGradient
+{
+    public:
+        ConjugateGradient() = delete;
+
+        ConjugateGradient(const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config);
+
+        // r = f - A phi, z = M r, p = z; returns the norms of r.
+        ResidualNorm start(const Flow &phi, const Flow &f);
+
+        // One CG step on phi; returns the norms of the updated residual.
+        ResidualNorm iterate(Flow &phi);
+
+    private:
+        void precondition();
+
+        const IStorage &II;
+        MultigridWorkspace &ws;
+        const SolverConfig &config;
+        Flow r;
+        Flow z;
+        Flow p;
+        Flow q;
+        double rz;
+};
+
+#endif
@@ -1,157 +1,208 @@
 #include "mg.hpp"
 #include <iostream>
+#include <type_traits>
 #include <utility>
 
 using namespace std;
 
-const size_t preSmooting = 5;
-const size_t coarsestSmooting = 5;
-const size_t postSmooting = 5;
+// Whether the cycles stop recursing at the level of coarseF.
+static bool isCoarsest(const Flow &coarseF, const SolverConfig &config)
+{
+    return (coarseF.rows() < 5) || (coarseF.cols() < 5) || ((coarseF.rows() * coarseF.cols()) <= config.directSolveCells);
+}
 
-void vCycle(UV &phi, UV &f, const IStorage &II, float alpha, size_t level)
+// Red-black smoothing of a level. The split layout with precomputed
+// coefficients uses the vectorised kernels on the level's compacted copy if
+// that fits in cache; otherwise all sweeps run as one temporally blocked pass.
+template< CoefficientLayout Coeffs >
+static void redBlack(Flow &phi, const Flow &f, const Coeffs &c, MultigridWorkspace &ws, size_t level, float alpha, size_t sweeps)
 {
-    //Pre-Smoothing
-    checkMultithreading(phi.u.rows(), phi.u.cols());
-    for (size_t i = 0; i < preSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
+    if constexpr (std::is_same_v<Flow, UV> && std::is_same_v<Coeffs, Coefficients>) {
+        if(RedBlackLevel::fitsCache(c.rows(), c.cols())) {
+            ws.redBlack(level, c).smooth(phi, f, alpha, sweeps);
+            return;
+        }
+    }
+    rbgs(phi, f, c, alpha, sweeps);
+}
 
-    //Compute Residual Error
-    UV residual = calcResidual(phi, f, II(level), alpha);
+// All sweeps of a smoothing step are run as one temporally blocked pass.
+template< CoefficientLayout Coeffs >
+static void smooth(Flow &phi, const Flow &f, const Coeffs &c, MultigridWorkspace &ws, size_t level, const SolverConfig &config, size_t sweeps)
+{
+    if (config.smoother == Smoother::Block)
+        blockRbgs(phi, f, c, config.alpha, sweeps);
+    else
+        redBlack(phi, f, c, ws, level, config.alpha, sweeps);
+}
 
-    //Restrict
-    residual.restrict();
+// Exact solve (or, with directSolveCells == 0, smoothing) of the coarsest level.
+static void coarseSolve(Flow &eps, const Flow &coarseF, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level)
+{
+    if(config.directSolveCells > 0) {
+        ws.scheduler.enter(level);
+        ws.direct(levelCoefficients(II, level), II(level).x.rows(), II(level).x.cols(), config.alpha).solve(eps, coarseF);
+    }
+    else {
+        ws.scheduler.run(level, [&]() { smooth(eps, coarseF, levelCoefficients(II, level), ws, level, config, config.coarsestSmoothing); });
+    }
+}
+
+void vCycle(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level)
+{
+    //Pre-Smoothing
+    ws.scheduler.enter(level);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.preSmoothing); });
 
-    UV eps(residual.u.getShape(), 0.0, phi.u.getShape());
+    //Compute Residual Error and Restrict
+    Flow &coarseF = ws.f(level + 1);
+    calcResidualRestricted(coarseF, phi, f, levelCoefficients(II, level), config.alpha, ws.columns(level),
+                           (level == 0) ? &ws.fineResidual : nullptr);
+
+    Flow &eps = ws.eps(level + 1);
+    eps.fill(0.0);
 
     //recursion
-    if((residual.u.rows() < 5) || (residual.u.cols() < 5)) {
-        for (size_t i = 0; i < coarsestSmooting; i++)
-            rbgs(eps, residual, II(level + 1), alpha);
+    if(isCoarsest(coarseF, config)) {
+        coarseSolve(eps, coarseF, II, ws, config, (level + 1));
     }
     else {
-        vCycle(eps, residual, II, alpha, (level + 1));
+        vCycle(eps, coarseF, II, ws, config, (level + 1));
     }
-    checkMultithreading(phi.u.rows(), phi.u.cols());
+    ws.scheduler.enter(level);
 
     //Prolongation and Correction
-    eps.prolongateInPlace();
-    phi += eps;
+    phi.prolongateAdd(eps);
 
     //Post-Smoothing
-    for (size_t i = 0; i < postSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.postSmoothing); });
 }
 
-void fCycle(UV &phi, UV &f, const IStorage &II, float alpha, size_t level)
+void fCycle(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level)
 {
     //Pre-Smoothing
-    checkMultithreading(phi.u.rows(), phi.u.cols());
-    for (size_t i = 0; i < preSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
-
-    //Compute Residual Error
-    UV residual = calcResidual(phi, f, II(level), alpha);
+    ws.scheduler.enter(level);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.preSmoothing); });
 
-    //Restrict
-    residual.restrict();
+    //Compute Residual Error and Restrict
+    Flow &coarseF = ws.f(level + 1);
+    calcResidualRestricted(coarseF, phi, f, levelCoefficients(II, level), config.alpha, ws.columns(level),
+                           (level == 0) ? &ws.fineResidual : nullptr);
 
-    UV eps(residual.u.getShape(), 0.0, phi.u.getShape());
+    Flow &eps = ws.eps(level + 1);
+    eps.fill(0.0);
 
     //F-Cycle Recursion
-    if((residual.u.rows() < 5) || (residual.u.cols() < 5)) {
-        for (size_t i = 0; i < coarsestSmooting; i++)
-            rbgs(eps, residual, II(level + 1), alpha);
+    if(isCoarsest(coarseF, config)) {
+        coarseSolve(eps, coarseF, II, ws, config, (level + 1));
     }
     else {
-        fCycle(eps, residual, II, alpha, (level + 1));
+        fCycle(eps, coarseF, II, ws, config, (level + 1));
     }
-    checkMultithreading(phi.u.rows(), phi.u.cols());
+    ws.scheduler.enter(level);
 
     //Prolongation and Correction
-    phi += eps.prolongate();
+    phi.prolongateAdd(eps);
 
     //Re-Smoothing
-    for (size_t i = 0; i < postSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.postSmoothing); });
 
-    //Compute Residual Error
-    residual = calcResidual(phi, f, II(level), alpha);
-
-    //Restrict
-    residual.restrict();
+    //Compute Residual Error and Restrict
+    calcResidualRestricted(coarseF, phi, f, levelCoefficients(II, level), config.alpha, ws.columns(level));
 
     //V-Cycle Recursion
-    if((residual.u.rows() < 5) || (residual.u.cols() < 5)) {
-        for (size_t i = 0; i < coarsestSmooting; i++)
-            rbgs(eps, residual, II(level + 1), alpha);
+    if(isCoarsest(coarseF, config)) {
+        coarseSolve(eps, coarseF, II, ws, config, (level + 1));
     }
     else {
-        vCycle(eps, residual, II, alpha, (level + 1));
+        vCycle(eps, coarseF, II, ws, config, (level + 1));
     }
-    checkMultithreading(phi.u.rows(), phi.u.cols());
+    ws.scheduler.enter(level);
 
     //Prolongation and Correction
-    eps.prolongateInPlace();
-    phi += eps;
+    phi.prolongateAdd(eps);
 
     //Post-Smoothing
-    for (size_t i = 0; i < postSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.postSmoothing); });
 }
 
-void wCycle(UV &phi, UV &f, const IStorage &II, float alpha, size_t level)
+void wCycle(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level)
 {
     //Pre-Smoothing
-    checkMultithreading(phi.u.rows(), phi.u.cols());
-    for (size_t i = 0; i < preSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
-
-    //Compute Residual Error
-    UV residual = calcResidual(phi, f, II(level), alpha);
+    ws.scheduler.enter(level);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.preSmoothing); });
 
-    //Restrict
-    residual.restrict();
+    //Compute Residual Error and Restrict
+    Flow &coarseF = ws.f(level + 1);
+    calcResidualRestricted(coarseF, phi, f, levelCoefficients(II, level), config.alpha, ws.columns(level),
+                           (level == 0) ? &ws.fineResidual : nullptr);
 
-    UV eps(residual.u.getShape(), 0.0, phi.u.getShape());
+    Flow &eps = ws.eps(level + 1);
+    eps.fill(0.0);
 
     //F-Cycle Recursion
-    if((residual.u.rows() < 5) || (residual.u.cols() < 5)) {
-        for (size_t i = 0; i < coarsestSmooting; i++)
-            rbgs(eps, residual, II(level + 1), alpha);
+    if(isCoarsest(coarseF, config)) {
+        coarseSolve(eps, coarseF, II, ws, config, (level + 1));
     }
     else {
-        wCycle(eps, residual, II, alpha, (level + 1));
+        wCycle(eps, coarseF, II, ws, config, (level + 1));
     }
-    checkMultithreading(phi.u.rows(), phi.u.cols());
+    ws.scheduler.enter(level);
 
     //Prolongation and Correction
-    phi += eps.prolongate();
+    phi.prolongateAdd(eps);
 
     //Re-Smoothing
-    for (size_t i = 0; i < postSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.postSmoothing); });
 
-    //Compute Residual Error
-    residual = calcResidual(phi, f, II(level), alpha);
-
-    //Restrict
-    residual.restrict();
+    //Compute Residual Error and Restrict
+    calcResidualRestricted(coarseF, phi, f, levelCoefficients(II, level), config.alpha, ws.columns(level));
 
     //V-Cycle Recursion
-    if((residual.u.rows() < 5) || (residual.u.cols() < 5)) {
-        for (size_t i = 0; i < coarsestSmooting; i++)
-            rbgs(eps, residual, II(level + 1), alpha);
+    if(isCoarsest(coarseF, config)) {
+        coarseSolve(eps, coarseF, II, ws, config, (level + 1));
     }
     else {
-        wCycle(eps, residual, II, alpha, (level + 1));
+        wCycle(eps, coarseF, II, ws, config, (level + 1));
     }
-    checkMultithreading(phi.u.rows(), phi.u.cols());
+    ws.scheduler.enter(level);
 
     //Prolongation and Correction
-    eps.prolongateInPlace();
-    phi += eps;
+    phi.prolongateAdd(eps);
 
     //Post-Smoothing
-    for (size_t i = 0; i < postSmooting; i++)
-        rbgs(phi, f, II(level), alpha);
-}
\ No newline at end of file
+    ws.scheduler.run(level, [&]() { smooth(phi, f, levelCoefficients(II, level), ws, level, config, config.postSmoothing); });
+}
+
+// Full multigrid: f is restricted down to the level the cycles stop at, which
+// is solved first. Every finer level then starts from the prolongated
+// solution of the level below and gets one F-cycle, ending on phi. The
+// per-level solutions and right-hand sides live in ws.eps / ws.f; a cycle on
+// level l only overwrites the buffers of the levels below it.
+void fmg(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config)
+{
+    ws.scheduler.enter(0);
+    f.restrictInto(ws.f(1));
+    size_t coarsest = 1;
+    while(!isCoarsest(ws.f(coarsest), config)) {
+        ws.scheduler.enter(coarsest);
+        ws.f(coarsest).restrictInto(ws.f(coarsest + 1));
+        coarsest++;
+    }
+
+    ws.eps(coarsest).fill(0.0);
+    coarseSolve(ws.eps(coarsest), ws.f(coarsest), II, ws, config, coarsest);
+
+    for(size_t level = coarsest - 1; level >= 1; level--) {
+        ws.scheduler.enter(level);
+        Flow &solution = ws.eps(level);
+        solution.fill(0.0);
+        solution.prolongateAdd(ws.eps(level + 1));
+        fCycle(solution, ws.f(level), II, ws, config, level);
+    }
+
+    ws.scheduler.enter(0);
+    phi.fill(0.0);
+    phi.prolongateAdd(ws.eps(1));
+    fCycle(phi, f, II, ws, config, 0);
+}
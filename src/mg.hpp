@@ -8,18 +8,14 @@
 #include "Matrix.hpp"
 #include "FlowField.hpp"
 #include "ImgDer.hpp"
+#include "Layout.hpp"
+#include "Workspace.hpp"
 #include "solver.hpp"
+#include "Config.hpp"
 
-void vCycle(UV &phi, UV &f, const IStorage &II, float alpha, size_t level);
-void fCycle(UV &phi, UV &f, const IStorage &II, float alpha, size_t level);
-void wCycle(UV &phi, UV &f, const IStorage &II, float alpha, size_t level);
-
-inline void checkMultithreading(size_t rows, size_t cols)
-{
-    if(cols < 25 || rows < 25)
-        omp_set_num_threads(1);
-    else
-        omp_set_num_threads(6);
-}
+void vCycle(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level);
+void fCycle(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level);
+void wCycle(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config, size_t level);
+void fmg(Flow &phi, Flow &f, const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "refine.hpp"
+#include "mg.hpp"
+
+using namespace std;
+
+IterativeRefinement::IterativeRefinement(const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config) :
+    II(II),
+    ws(ws),
+    config(config),
+    x(II(0).x.getShape(), 0.0),
+    f(II(0).x.getShape(), 0.0),
+    r(II(0).x.getShape(), 0.0),
+    e(II(0).x.getShape(), 0.0, II(0).x.getShape()),
+    rf(II(0).x.getShape(), 0.0, II(0).x.getShape())
+{ }
+
+ResidualNorm IterativeRefinement::start(const Flow &phi, const Flow &f)
+{
+    ws.scheduler.enter(0);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (x.cols() - 1); j++)
+        for(size_t i = 1; i < (x.rows() - 1); i++) {
+            x.u(i, j) = phi.u(i, j);
+            x.v(i, j) = phi.v(i, j);
+            this->f.u(i, j) = f.u(i, j);
+            this->f.v(i, j) = f.v(i, j);
+        }
+
+    calcResidual(r, x, this->f, levelCoefficients(II, 0), config.alpha);
+    norm = flowNorm(r);
+    return norm;
+}
+
+ResidualNorm IterativeRefinement::iterate()
+{
+    ws.scheduler.enter(0);
+    const double scale = (norm.linf > 0) ? (1.0 / norm.linf) : 1.0;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (x.cols() - 1); j++)
+        for(size_t i = 1; i < (x.rows() - 1); i++) {
+            rf.u(i, j) = r.u(i, j) * scale;
+            rf.v(i, j) = r.v(i, j) * scale;
+        }
+
+    e.fill(0.0);
+    switch(config.cycle) {
+        case CycleType::V:
+            vCycle(e, rf, II, ws, config, 0);
+            break;
+        case CycleType::W:
+            wCycle(e, rf, II, ws, config, 0);
+            break;
+        case CycleType::FMG:
+            fmg(e, rf, II, ws, config);
+            break;
+        default:
+            fCycle(e, rf, II, ws, config, 0);
+    }
+    ws.scheduler.enter(0);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (x.cols() - 1); j++)
+        for(size_t i = 1; i < (x.rows() - 1); i++) {
+            x.u(i, j) += e.u(i, j) / scale;
+            x.v(i, j) += e.v(i, j) / scale;
+        }
+
+    calcResidual(r, x, f, levelCoefficients(II, 0), config.alpha);
+    norm = flowNorm(r);
+    return norm;
+}
+
+void IterativeRefinement::solution(Flow &phi) const
+{
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (x.cols() - 1); j++)
+        for(size_t i = 1; i < (x.rows() - 1); i++) {
+            phi.u(i, j) = x.u(i, j);
+            phi.v(i, j) = x.v(i, j);
+        }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#ifndef REFINE
+#define REFINE
+
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+#include "Layout.hpp"
+#include "Workspace.hpp"
+#include "Config.hpp"
+#include "solver.hpp"
+
+using PreciseUV = BasicUV<double>;
+
+// Mixed-precision iterative refinement. The fine-grid solution x and the
+// residual r = f - A x are kept and evaluated in double; every step solves
+// A e = r approximately with one float multigrid cycle (config.cycle) and
+// adds e to x in double. r is scaled to unit maximum before it is rounded
+// to float, so the corrections neither lose their leading digits nor
+// underflow into the flushed denormal range as the residual shrinks.
+class IterativeRefinement
+{
+    public:
+        IterativeRefinement() = delete;
+
+        IterativeRefinement(const IStorage &II, MultigridWorkspace &ws, const SolverConfig &config);
+
+        // x = phi, r = f - A x; returns the norms of r.
+        ResidualNorm start(const Flow &phi, const Flow &f);
+
+        // One correction step; returns the norms of the new residual.
+        ResidualNorm iterate();
+
+        // Rounds x to float.
+        void solution(Flow &phi) const;
+
+    private:
+        const IStorage &II;
+        MultigridWorkspace &ws;
+        const SolverConfig &config;
+        PreciseUV x;
+        PreciseUV f;
+        PreciseUV r;
+        Flow e;
+        Flow rf;
+        ResidualNorm norm;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#pragma once
+#ifndef SIMD
+#define SIMD
+
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <unistd.h>
+#include "Buffer.hpp"
+#include "FlowField.hpp"
+#include "ImgDer.hpp"
+
+// Vectorised red-black Gauss-Seidel for the split layout with precomputed
+// coefficients. The level is copied into checkerboard-compacted storage:
+// every column of every field is split into its red and its black cells,
+// each stored contiguously. A half-sweep then writes one colour and reads
+// only the other colour of the same component (whose (i - 1) and (i + 1)
+// neighbours are two consecutive entries) and the same colour of the other
+// component, so all loads are unit-stride and full-width and no lane is
+// shared with a column another thread writes.
+
+enum class SimdLevel { Scalar, AVX2, AVX512 };
+
+// Widest instruction set supported by the CPU. FLOW_SIMD=scalar|avx2|avx512
+// restricts the choice, e.g. for benchmarking.
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        SimdLevel supported = SimdLevel::Scalar;
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            supported = SimdLevel::AVX2;
+        if(__builtin_cpu_supports("avx512f"))
+            supported = SimdLevel::AVX512;
+
+        const char *requested = std::getenv("FLOW_SIMD");
+        if(requested == nullptr)
+            return supported;
+        if(std::strcmp(requested, "scalar") == 0)
+            return SimdLevel::Scalar;
+        if(std::strcmp(requested, "avx2") == 0 && supported != SimdLevel::Scalar)
+            return SimdLevel::AVX2;
+        return supported;
+    }();
+    return level;
+}
+
+// Updates x[k] = (f + alpha * (below + above + right + left) - cross * y) * inv
+// for first <= k < end, in the order of HornSchunckOperator::relaxU. above[k]
+// and above[k + 1] are the (i - 1) and (i + 1) neighbours, other[k -+ ld]
+// the (j -+ 1) neighbours, all of the other colour.
+inline void redBlackColumnScalar(float *x, const float *above, const float *other, const float *y, const float *f,
+                                 const float *cross, const float *inv, float alpha, size_t ld, size_t first, size_t end)
+{
+    for(size_t k = first; k < end; k++)
+        x[k] = (f[k] + alpha * (above[k + 1] + above[k] + other[k + ld] + other[k - ld]) - cross[k] * y[k]) * inv[k];
+}
+
+__attribute__((target("avx2,fma")))
+inline void redBlackColumnAVX2(float *x, const float *above, const float *other, const float *y, const float *f,
+                               const float *cross, const float *inv, float alpha, size_t ld, size_t first, size_t end)
+{
+    const __m256 a = _mm256_set1_ps(alpha);
+    size_t k = first;
+    for(; (k + 8) <= end; k += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(above + k + 1), _mm256_loadu_ps(above + k));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(other + k + ld));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(other + k - ld));
+        __m256 r = _mm256_fmadd_ps(a, sum, _mm256_loadu_ps(f + k));
+        r = _mm256_fnmadd_ps(_mm256_loadu_ps(cross + k), _mm256_loadu_ps(y + k), r);
+        _mm256_storeu_ps(x + k, _mm256_mul_ps(r, _mm256_loadu_ps(inv + k)));
+    }
+    redBlackColumnScalar(x, above, other, y, f, cross, inv, alpha, ld, k, end);
+}
+
+__attribute__((target("avx512f")))
+inline void redBlackColumnAVX512(float *x, const float *above, const float *other, const float *y, const float *f,
+                                 const float *cross, const float *inv, float alpha, size_t ld, size_t first, size_t end)
+{
+    const __m512 a = _mm512_set1_ps(alpha);
+    size_t k = first;
+    for(; (k + 16) <= end; k += 16) {
+        __m512 sum = _mm512_add_ps(_mm512_loadu_ps(above + k + 1), _mm512_loadu_ps(above + k));
+        sum = _mm512_add_ps(sum, _mm512_loadu_ps(other + k + ld));
+        sum = _mm512_add_ps(sum, _mm512_loadu_ps(other + k - ld));
+        __m512 r = _mm512_fmadd_ps(a, sum, _mm512_loadu_ps(f + k));
+        r = _mm512_fnmadd_ps(_mm512_loadu_ps(cross + k), _mm512_loadu_ps(y + k), r);
+        _mm512_storeu_ps(x + k, _mm512_mul_ps(r, _mm512_loadu_ps(inv + k)));
+    }
+    redBlackColumnScalar(x, above, other, y, f, cross, inv, alpha, ld, k, end);
+}
+
+// Checkerboard-compacted copy of one level. Cell (i, j) has colour
+// (i + j) % 2; column j of colour c holds the rows i = 2k + (j + c) % 2 at
+// k = 0, ..., height - 1, ghost layer included. The coefficients are packed
+// once by bind(); smooth() packs the flow and right-hand side, runs the
+// sweeps on the compacted fields and writes the interior back.
+class RedBlackLevel
+{
+    public:
+        RedBlackLevel() = delete;
+
+        RedBlackLevel(size_t rows, size_t cols) :
+            rows(rows),
+            cols(cols),
+            height((rows + 1) / 2),
+            bound(false),
+            u(2 * height * cols), v(2 * height * cols), fu(2 * height * cols), fv(2 * height * cols),
+            cross(2 * height * cols), invU(2 * height * cols), invV(2 * height * cols) { }
+
+        // Whether the compacted fields of a level fit the L2 cache. Larger
+        // levels are memory bound, and the temporally blocked rbgs() is faster
+        // there than packing and sweeping the compacted copy.
+        static bool fitsCache(size_t rows, size_t cols) {
+            static const size_t cache = []() {
+                long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+                return (size > 0) ? size_t(size) : size_t(1) << 20;
+            }();
+            return 7 * (2 * ((rows + 1) / 2) * cols) * sizeof(float) <= cache;
+        }
+
+        RedBlackLevel(const RedBlackLevel &) = delete;
+        RedBlackLevel& operator=(const RedBlackLevel &) = delete;
+
+        inline bool isBound() const {
+            return bound;
+        }
+
+        // Packs the coefficients of the level; again after they changed.
+        void bind(const Coefficients &c) {
+            pack(cross, [&](size_t i, size_t j) { return c.cross(i, j); });
+            pack(invU, [&](size_t i, size_t j) { return c.invDiagU(c.weight(), i, j); });
+            pack(invV, [&](size_t i, size_t j) { return c.invDiagV(c.weight(), i, j); });
+            bound = true;
+        }
+
+        inline void unbind() {
+            bound = false;
+        }
+
+        // nSweeps sweeps of rbgs() (u red, u black, v red, v black) with the
+        // kernel of the given instruction set.
+        void smooth(UV &phi, const UV &f, float alpha, size_t nSweeps, SimdLevel simd = simdLevel()) {
+            switch(simd) {
+                case SimdLevel::AVX512:
+                    smooth(redBlackColumnAVX512, phi, f, alpha, nSweeps);
+                    break;
+                case SimdLevel::AVX2:
+                    smooth(redBlackColumnAVX2, phi, f, alpha, nSweeps);
+                    break;
+                default:
+                    smooth(redBlackColumnScalar, phi, f, alpha, nSweeps);
+            }
+        }
+
+    private:
+        inline size_t column(size_t colour, size_t j) const {
+            return (colour * cols + j) * height;
+        }
+
+        template< class Value >
+        void pack(AlignedVector<float> &field, Value value) {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < cols; j++)
+                for(size_t colour = 0; colour < 2; colour++) {
+                    float *out = field.data() + column(colour, j);
+                    for(size_t k = 0, i = (j + colour) % 2; k < height; k++, i += 2)
+                        out[k] = (i < rows) ? value(i, j) : 0.0f;
+                }
+        }
+
+        // Splits the column-major matrix m into its two colours, one pass
+        // over each column.
+        void pack(AlignedVector<float> &field, const Matrix<float> &m) {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 0; j < cols; j++) {
+                const float *in = m.data() + (rows * j);
+                float *even = field.data() + column(j % 2, j);
+                float *odd = field.data() + column(1 - (j % 2), j);
+                for(size_t k = 0; k < (rows / 2); k++) {
+                    even[k] = in[2 * k];
+                    odd[k] = in[(2 * k) + 1];
+                }
+                if((rows % 2) == 1) {
+                    even[height - 1] = in[rows - 1];
+                    odd[height - 1] = 0.0f;
+                }
+            }
+        }
+
+        void unpack(Matrix<float> &m, const AlignedVector<float> &field) const {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 1; j < (cols - 1); j++) {
+                float *out = m.data() + (rows * j);
+                const float *even = field.data() + column(j % 2, j);
+                const float *odd = field.data() + column(1 - (j % 2), j);
+                for(size_t k = 0; k < ((rows - 1) / 2); k++)
+                    out[(2 * k) + 1] = odd[k];
+                for(size_t k = 1; k < (rows / 2); k++)
+                    out[2 * k] = even[k];
+            }
+        }
+
+        // One colour of one component: x is updated from the other colour
+        // of x and the same colour of y.
+        template< class ColumnKernel >
+        void halfSweep(ColumnKernel kernel, AlignedVector<float> &x, const AlignedVector<float> &y,
+                       const AlignedVector<float> &f, const AlignedVector<float> &inv, float alpha, size_t colour) {
+            #pragma omp parallel for schedule(static)
+            for(size_t j = 1; j < (cols - 1); j++) {
+                const size_t parity = (j + colour) % 2;
+                const size_t first = 1 - parity;
+                const size_t end = ((rows - 2 - parity) / 2) + 1;
+                const size_t here = column(colour, j);
+                const float *other = x.data() + column(1 - colour, j);
+                kernel(x.data() + here, other + parity - 1, other, y.data() + here, f.data() + here,
+                       cross.data() + here, inv.data() + here, alpha, height, first, end);
+            }
+        }
+
+        template< class ColumnKernel >
+        void smooth(ColumnKernel kernel, UV &phi, const UV &f, float alpha, size_t nSweeps) {
+            pack(u, phi.u);
+            pack(v, phi.v);
+            pack(fu, f.u);
+            pack(fv, f.v);
+
+            // the same colour order as rbgs(): (i + j) odd first
+            for(size_t sweep = 0; sweep < nSweeps; sweep++) {
+                halfSweep(kernel, u, v, fu, invU, alpha, 1);
+                halfSweep(kernel, u, v, fu, invU, alpha, 0);
+                halfSweep(kernel, v, u, fv, invV, alpha, 1);
+                halfSweep(kernel, v, u, fv, invV, alpha, 0);
+            }
+
+            unpack(phi.u, u);
+            unpack(phi.v, v);
+        }
+
+        size_t rows, cols, height;
+        bool bound;
+        AlignedVector<float> u, v, fu, fv, cross, invU, invV;
+};
+
+#endif
@@ -2,101 +2,409 @@
 #ifndef SOLVER
 #define SOLVER
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 #include "Matrix.hpp"
 #include "FlowField.hpp"
 #include "ImgDer.hpp"
+#include "Operator.hpp"
 
 #include <omp.h>
 
 using namespace std;
 
+// The kernels below are templated over the storage layout: Flow is UV or
+// InterleavedUV, Coeffs is I, Coefficients or PackedI. The stencil itself
+// comes from HornSchunckOperator.
+
 
 //ITERATIVE SOLVER
 
-inline float iterationFormulaU(const Matrix<float> &u, float v, float Ix, float Iy, float alpha, float f, size_t i, size_t j)
+// Smoothers available to the multigrid cycles.
+enum class Smoother { RedBlack, Block };
+
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void gaussSeidel(Flow &phi, const Flow &f, const Coeffs &c, float alpha)
 {
-    return (    + f
-                + alpha * ( u((i + 1), j) + u((i - 1), j) + u(i, (j + 1)) + u(i, (j - 1)) )
-                - (Ix * Iy * v)
-            )
-            / ((Ix * Ix) + (4.0 * alpha));
-}
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+    for(size_t j = 1; j < (phi.cols() - 1); j++)
+        for(size_t i = 1; i < (phi.rows() - 1); i++) {
+            phi.u(i, j) = A.relaxU(phi, f, i, j);
+            phi.v(i, j) = A.relaxV(phi, f, i, j);
+        }
+}           
 
-inline float iterationFormulaV(const Matrix<float> &v, float u, float Ix, float Iy, float alpha, float f, size_t i, size_t j)
+// Updates one colour of u (resp. v) in column j.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void rbgsColumnU(Flow &phi, const Flow &f, const Coeffs &c, float alpha, size_t j, size_t offset)
 {
-    return  (   + f
-                + alpha * ( v((i + 1), j) + v((i - 1), j) + v(i, (j + 1)) + v(i, (j - 1)))
-                - (Ix * Iy * u)
-            )
-            / ((Iy * Iy) + (4.0 * alpha));
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+    for(size_t i = 1 + ((j + offset) % 2); i < (phi.rows() - 1); i += 2)
+        phi.u(i, j) = A.relaxU(phi, f, i, j);
 }
 
-
-inline void gaussSeidel(UV &phi, const UV &f, const I &I, float alpha)
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void rbgsColumnV(Flow &phi, const Flow &f, const Coeffs &c, float alpha, size_t j, size_t offset)
 {
-    for(size_t j = 1; j < (phi.u.cols() - 1); j++)
-        for(size_t i = 1; i < (phi.u.rows() - 1); i++) {
-            phi.u(i, j) = iterationFormulaU(phi.u, phi.v(i, j), I.x(i, j), I.y(i, j), alpha, f.u(i, j), i, j);
-            phi.v(i, j) = iterationFormulaV(phi.v, phi.u(i, j), I.x(i, j), I.y(i, j), alpha, f.v(i, j), i, j);
-        }
-}           
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+    for(size_t i = 1 + ((j + offset) % 2); i < (phi.rows() - 1); i += 2)
+        phi.v(i, j) = A.relaxV(phi, f, i, j);
+}
 
-inline void rbgs(UV &phi, const UV &f, const I &I, float alpha)
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void rbgs(Flow &phi, const Flow &f, const Coeffs &c, float alpha)
 {
    //update u
     for(size_t offset = 0; offset < 2; offset++)
     {
         #pragma omp parallel for schedule(static)
-        for(size_t j = 1; j < (phi.u.cols() - 1); j++)
-            for(size_t i = 1 + ((j + offset) % 2); i < (phi.u.rows() - 1); i += 2) {
-                phi.u(i, j) = iterationFormulaU(phi.u, phi.v(i, j), I.x(i, j), I.y(i, j), alpha, f.u(i, j), i, j);
-            }
+        for(size_t j = 1; j < (phi.cols() - 1); j++)
+            rbgsColumnU(phi, f, c, alpha, j, offset);
     }
 
     //update v
     for(size_t offset = 0; offset < 2; offset++)
     {
         #pragma omp parallel for schedule(static)
-        for(size_t j = 1; j < (phi.u.cols() - 1); j++)
-            for(size_t i = 1 + ((j + offset) % 2); i < (phi.u.rows() - 1); i += 2) {
-                phi.v(i, j) = iterationFormulaV(phi.v, phi.u(i, j), I.x(i, j), I.y(i, j), alpha, f.v(i, j), i, j);
-            }
+        for(size_t j = 1; j < (phi.cols() - 1); j++)
+            rbgsColumnV(phi, f, c, alpha, j, offset);
     }          
 }
 
 
-//RESIDUAL
+// Coupled red-black Gauss-Seidel: every point solves its 2x2 system
+// [diagU cross; cross diagV] (u, v) = (f + alpha * neighbour sums) exactly,
+// so u and v are updated together in one pass per colour.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void blockRbgsColumn(Flow &phi, const Flow &f, const Coeffs &c, float alpha, size_t j, size_t offset)
+{
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+    for(size_t i = 1 + ((j + offset) % 2); i < (phi.rows() - 1); i += 2)
+        A.relaxBlock(phi, f, i, j);
+}
 
-inline float residualU(const Matrix<float> &u, float v, float Ix, float Iy, float f, float alpha, size_t i, size_t j)
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void blockRbgs(Flow &phi, const Flow &f, const Coeffs &c, float alpha)
 {
-    return  + f
-            - ((Ix * Ix) + (4.0 * alpha)) * u(i, j)
-            + alpha * ( u((i + 1), j) + u((i - 1), j) + u(i, (j + 1)) + u(i, (j - 1)) )
-            - (Ix * Iy * v);
+    for(size_t offset = 0; offset < 2; offset++)
+    {
+        #pragma omp parallel for schedule(static)
+        for(size_t j = 1; j < (phi.cols() - 1); j++)
+            blockRbgsColumn(phi, f, c, alpha, j, offset);
+    }
+}
+
+
+//TEMPORAL BLOCKING
+
+// Runs stage t on the interior columns first(t) <= j < last(t) as a
+// wavefront: stage t of column j is executed in step j + 2t. A stage only
+// reads the neighbouring columns of the previous stage, which are finished
+// one step earlier, so the columns between the first and the last stage stay
+// in cache.
+template< class Stage, class First, class Last >
+inline void wavefrontRange(size_t stages, First first, Last last, Stage &stage)
+{
+    size_t begin = SIZE_MAX, end = 0;
+    for(size_t t = 0; t < stages; t++)
+        if(first(t) < last(t)) {
+            begin = std::min(begin, first(t) + 2 * t);
+            end = std::max(end, last(t) + 2 * t);
+        }
+
+    for(size_t step = begin; step < end; step++)
+        for(size_t t = 0; (t < stages) && (2 * t <= step); t++) {
+            const size_t j = step - 2 * t;
+            if((j >= first(t)) && (j < last(t)))
+                stage(t, j);
+        }
+}
+
+// Runs a sequence of column-wise stages (the half-sweeps of several smoother
+// iterations) with the same result as running them one after another over
+// the whole grid. Every thread owns the block of interior columns that
+// schedule(static) gives it and runs the wavefront on a trapezoid of it:
+// stage t skips t columns at each edge shared with another block, so no
+// stage needs a column of a neighbouring block. After one barrier the
+// triangles left at the block edges are filled in, again as wavefronts.
+// Blocks narrower than two columns per stage fall back to one
+// column-parallel loop per stage.
+template< class Stage >
+inline void wavefront(size_t cols, size_t stages, Stage stage)
+{
+    const size_t interior = cols - 2;
+
+    #pragma omp parallel
+    {
+        const size_t threads = omp_get_num_threads();
+        const size_t id = omp_get_thread_num();
+
+        if((threads == 1) || (interior >= 2 * stages * threads)) {
+            // the partition of schedule(static) over 1, ..., cols - 2
+            auto edge = [&](size_t b) { return 1 + b * (interior / threads) + std::min(b, interior % threads); };
+            const size_t lo = edge(id), hi = edge(id + 1);
+            const size_t shrinkLo = (id > 0), shrinkHi = (id + 1 < threads);
+
+            wavefrontRange(stages, [&](size_t t) { return lo + shrinkLo * t; },
+                           [&](size_t t) { return hi - shrinkHi * t; }, stage);
+
+            #pragma omp barrier
+
+            if(shrinkHi)
+                wavefrontRange(stages, [&](size_t t) { return hi - t; }, [&](size_t t) { return hi + t; }, stage);
+        }
+        else {
+            for(size_t t = 0; t < stages; t++) {
+                #pragma omp for schedule(static)
+                for(size_t j = 1; j < (cols - 1); j++)
+                    stage(t, j);
+            }
+        }
+    }
+}
+
+// nSweeps red-black sweeps in one pass over memory.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void rbgs(Flow &phi, const Flow &f, const Coeffs &c, float alpha, size_t nSweeps)
+{
+    if(nSweeps == 0)
+        return;
+
+    wavefront(phi.cols(), 4 * nSweeps, [&](size_t t, size_t j) {
+        if((t % 4) < 2)
+            rbgsColumnU(phi, f, c, alpha, j, t % 2);
+        else
+            rbgsColumnV(phi, f, c, alpha, j, t % 2);
+    });
+}
+
+// nSweeps coupled red-black sweeps in one pass over memory.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void blockRbgs(Flow &phi, const Flow &f, const Coeffs &c, float alpha, size_t nSweeps)
+{
+    if(nSweeps == 0)
+        return;
+
+    wavefront(phi.cols(), 2 * nSweeps, [&](size_t t, size_t j) {
+        blockRbgsColumn(phi, f, c, alpha, j, t % 2);
+    });
+}
+
+
+//OPERATOR
+
+// q = A p over the interior, with the ghost layer of p entering as boundary
+// values (zero for the Krylov vectors).
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void applyOperator(Flow &q, const Flow &p, const Coeffs &c, float alpha)
+{
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (p.cols() - 1); j++)
+        for(size_t i = 1; i < (p.rows() - 1); i++) {
+            q.u(i, j) = A.applyU(p, i, j);
+            q.v(i, j) = A.applyV(p, i, j);
+        }
 }
 
-inline float residualV(const Matrix<float> &v, float u, float Ix, float Iy, float f, float alpha,  size_t i, size_t j)
+// z = D^-1 r with D the 2x2 point blocks of A (point-block Jacobi).
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void blockJacobi(Flow &z, const Flow &r, const Coeffs &c, float alpha)
 {
-    return  + f
-            - ((Iy * Iy) + (4.0 * alpha)) * v(i, j)
-            + alpha * ( v((i + 1), j) + v((i - 1), j) + v(i, (j + 1)) + v(i, (j - 1)) )
-            - (Ix * Iy * u);
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+
+    #pragma omp parallel for schedule(static)
+    for(size_t j = 1; j < (r.cols() - 1); j++)
+        for(size_t i = 1; i < (r.rows() - 1); i++) {
+            float zu, zv;
+            A.solveBlock(i, j, r.u(i, j), r.v(i, j), zu, zv);
+            z.u(i, j) = zu;
+            z.v(i, j) = zv;
+        }
 }
 
 
-inline UV calcResidual(const UV &phi, const UV &f, const I &I, float alpha)
+//RESIDUAL
+
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void calcResidual(Flow &res, const Flow &phi, const Flow &f, const Coeffs &c, float alpha)
 {
-    UV res(phi.u.getShape(), 0.0);
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
 
     #pragma omp parallel for schedule(static)
-    for(size_t j = 1; j < (phi.u.cols() - 1); j++)
-        for(size_t i = 1; i < (phi.u.rows() - 1); i++) {
-            res.u(i, j) = residualU(phi.u, phi.v(i, j), I.x(i, j), I.y(i, j), f.u(i, j), alpha, i, j);
-            res.v(i, j) = residualV(phi.v, phi.u(i, j), I.x(i, j), I.y(i, j), f.v(i, j), alpha, i, j);
+    for(size_t j = 1; j < (phi.cols() - 1); j++)
+        for(size_t i = 1; i < (phi.rows() - 1); i++) {
+            res.u(i, j) = A.residualU(phi, f, i, j);
+            res.v(i, j) = A.residualV(phi, f, i, j);
         }
+}
 
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline Flow calcResidual(const Flow &phi, const Flow &f, const Coeffs &c, float alpha)
+{
+    Flow res(phi.getShape(), 0.0);
+    calcResidual(res, phi, f, c, alpha);
     return res;
 }
 
-#endif
\ No newline at end of file
+
+//FUSED RESIDUAL NORM
+
+// Norms of the residual over the interior: l2 is the sum of the L2 norms of
+// both components (like UV::l2Norm), linf the largest absolute entry.
+struct ResidualNorm {
+    float l2 = 0.;
+    float linf = 0.;
+};
+
+// Reduces the residual to its norms without writing it to memory.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline ResidualNorm residualNorm(const Flow &phi, const Flow &f, const Coeffs &c, float alpha)
+{
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+    double sumU = 0., sumV = 0.;
+    float maxAbs = 0.;
+
+    #pragma omp parallel for schedule(static) reduction(+:sumU, sumV) reduction(max:maxAbs)
+    for(size_t j = 1; j < (phi.cols() - 1); j++)
+        for(size_t i = 1; i < (phi.rows() - 1); i++) {
+            const auto ru = A.residualU(phi, f, i, j);
+            const auto rv = A.residualV(phi, f, i, j);
+            sumU += ru * ru;
+            sumV += rv * rv;
+            maxAbs = std::max(maxAbs, float(std::max(std::abs(ru), std::abs(rv))));
+        }
+
+    return { float(std::sqrt(sumU) + std::sqrt(sumV)), maxAbs };
+}
+
+// Norms of an explicitly stored residual r, defined as in residualNorm().
+template< FlowLayout Flow >
+inline ResidualNorm flowNorm(const Flow &r)
+{
+    double sumU = 0., sumV = 0.;
+    float maxAbs = 0.;
+
+    #pragma omp parallel for schedule(static) reduction(+:sumU, sumV) reduction(max:maxAbs)
+    for(size_t j = 1; j < (r.cols() - 1); j++)
+        for(size_t i = 1; i < (r.rows() - 1); i++) {
+            const double ru = r.u(i, j), rv = r.v(i, j);
+            sumU += ru * ru;
+            sumV += rv * rv;
+            maxAbs = std::max(maxAbs, float(std::max(std::abs(ru), std::abs(rv))));
+        }
+
+    return { float(std::sqrt(sumU) + std::sqrt(sumV)), maxAbs };
+}
+
+
+//FUSED RESIDUAL AND RESTRICTION
+
+// Residual of the rows 1, ..., lastRow of fine column j; the ghost layer has
+// a residual of zero. The ghost row and column are handled outside the
+// loop over the interior, which has no branch.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void residualColumn(const Flow &phi, const Flow &f, const HornSchunckOperator<Flow, Coeffs> &A, size_t j, size_t lastRow,
+                           float *ru, float *rv)
+{
+    const size_t interior = (j < (phi.cols() - 1)) ? std::min(lastRow, phi.rows() - 2) : 0;
+    for(size_t i = 1; i <= interior; i++) {
+        ru[i] = A.residualU(phi, f, i, j);
+        rv[i] = A.residualV(phi, f, i, j);
+    }
+    for(size_t i = interior + 1; i <= lastRow; i++) {
+        ru[i] = 0.0;
+        rv[i] = 0.0;
+    }
+}
+
+// Floats of one thread's column buffers in calcResidualRestricted for a fine
+// level with the given number of rows, padded to whole cache lines.
+inline size_t residualColumnsStride(size_t fineRows)
+{
+    return 6 * (((fineRows + 15) / 16) * 16);
+}
+
+// Full-weighting restriction of the residual directly into the coarse grid.
+// Every coarse column jc needs the fine residual columns 2jc - 1, 2jc and
+// 2jc + 1; they are kept in three column buffers per thread, taken from
+// columns (residualColumnsStride(phi.rows()) floats per thread), and column
+// 2jc + 1 is carried over as column 2(jc + 1) - 1 of the next coarse column
+// of the same thread, so every fine residual is computed once (except at the
+// start of a thread's block) and never written to the fine grid. The team is
+// capped at the number of threads columns has room for. If norm is
+// given, it receives the norms of the fine residual; columns 2jc and 2jc + 1
+// (and column 1 for jc = 1) are counted so that every fine cell enters
+// exactly once.
+template< FlowLayout Flow, CoefficientLayout Coeffs >
+inline void calcResidualRestricted(Flow &coarse, const Flow &phi, const Flow &f, const Coeffs &c, float alpha,
+                                   AlignedVector<float> &columns, ResidualNorm *norm = nullptr)
+{
+    assert(coarse.rows() == ((phi.rows() - 2) / 2) + 2);
+    assert(coarse.cols() == ((phi.cols() - 2) / 2) + 2);
+
+    const HornSchunckOperator<Flow, Coeffs> A(c, alpha);
+    const size_t lastRow = 2 * (coarse.rows() - 2) + 1;
+    const size_t stride = residualColumnsStride(phi.rows());
+    const int team = int(std::min<size_t>(omp_get_max_threads(), columns.size() / stride));
+    assert(team > 0);
+    double sumU = 0., sumV = 0.;
+    float maxAbs = 0.;
+
+    #pragma omp parallel num_threads(team) reduction(+:sumU, sumV) reduction(max:maxAbs)
+    {
+        float *leftU = columns.data() + omp_get_thread_num() * stride, *leftV = leftU + (lastRow + 1);
+        float *midU = leftV + (lastRow + 1), *midV = midU + (lastRow + 1);
+        float *rightU = midV + (lastRow + 1), *rightV = rightU + (lastRow + 1);
+        size_t previous = 0;
+
+        // defined inside the region so that it updates the private reduction copies
+        auto accumulate = [&](const float *ru, const float *rv) {
+            for(size_t i = 1; i <= lastRow; i++) {
+                sumU += ru[i] * ru[i];
+                sumV += rv[i] * rv[i];
+                maxAbs = std::max(maxAbs, std::max(std::abs(ru[i]), std::abs(rv[i])));
+            }
+        };
+
+        #pragma omp for schedule(static)
+        for(size_t jc = 1; jc < (coarse.cols() - 1); jc++) {
+            if((previous != 0) && (previous + 1 == jc)) {
+                std::swap(leftU, rightU);
+                std::swap(leftV, rightV);
+            }
+            else
+                residualColumn(phi, f, A, 2 * jc - 1, lastRow, leftU, leftV);
+            residualColumn(phi, f, A, 2 * jc, lastRow, midU, midV);
+            residualColumn(phi, f, A, 2 * jc + 1, lastRow, rightU, rightV);
+            previous = jc;
+
+            if(norm != nullptr) {
+                if(jc == 1)
+                    accumulate(leftU, leftV);
+                accumulate(midU, midV);
+                accumulate(rightU, rightV);
+            }
+
+            for(size_t ic = 1; ic < (coarse.rows() - 1); ic++) {
+                const size_t i = 2 * ic;
+
+                float edgesU = leftU[i] + rightU[i] + midU[i - 1] + midU[i + 1];
+                float cornersU = leftU[i - 1] + rightU[i - 1] + leftU[i + 1] + rightU[i + 1];
+                coarse.u(ic, jc) = midU[i] / 4 + edgesU / 8 + cornersU / 16;
+
+                float edgesV = leftV[i] + rightV[i] + midV[i - 1] + midV[i + 1];
+                float cornersV = leftV[i - 1] + rightV[i - 1] + leftV[i + 1] + rightV[i + 1];
+                coarse.v(ic, jc) = midV[i] / 4 + edgesV / 8 + cornersV / 16;
+            }
+        }
+    }
+
+    if(norm != nullptr)
+        *norm = { float(std::sqrt(sumU) + std::sqrt(sumV)), maxAbs };
+}
+
+#endif